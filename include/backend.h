@@ -0,0 +1,81 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include <esp_err.h>
+
+/*
+ * The hardware under the controller, one small table per kind: PWM output,
+ * pulse counting and key/value storage. pwm.c, tacho.c, fanconfig.c and
+ * board.c only go through these, so the control, protocol and config code
+ * can run on a bare board against the simulated backend. A table is picked once
+ * at startup and each call through it is a single indirect call.
+ *
+ * Missing keys are reported as ESP_ERR_NOT_FOUND whatever the store.
+ */
+
+typedef struct {
+    /* one timer shared by every channel */
+    esp_err_t (*timer)(uint32_t freqHz, uint8_t bits);
+    esp_err_t (*channel)(uint8_t channel, uint8_t pin, bool invert, uint32_t counts);
+    /* duty and phase in timer counts, takes effect from the next period */
+    esp_err_t (*write)(uint8_t channel, uint32_t counts, uint32_t hpoint);
+} backend_pwm_t;
+
+typedef struct {
+    uint8_t units;
+    /* count falling edges on pin, wrapping to 0 at limit, 0 for no limit. Left paused and cleared */
+    esp_err_t (*setup)(uint8_t unit, uint8_t pin, int16_t limit);
+    esp_err_t (*read)(uint8_t unit, int16_t *count);
+    esp_err_t (*pause)(uint8_t unit);
+    esp_err_t (*resume)(uint8_t unit);
+    esp_err_t (*clear)(uint8_t unit);
+    esp_err_t (*set_pin)(uint8_t unit, uint8_t pin);
+    /* call isr(arg) from interrupt context on every falling edge of pin */
+    esp_err_t (*edges)(uint8_t pin, void (*isr)(void *arg), void *arg);
+} backend_count_t;
+
+typedef uint32_t backend_store_handle_t;
+
+typedef struct {
+    esp_err_t (*init)(void);
+    esp_err_t (*open)(const char *space, backend_store_handle_t *handle);
+    void (*close)(backend_store_handle_t handle);
+    esp_err_t (*get_u8)(backend_store_handle_t handle, const char *key, uint8_t *value);
+    esp_err_t (*get_u16)(backend_store_handle_t handle, const char *key, uint16_t *value);
+    esp_err_t (*get_u32)(backend_store_handle_t handle, const char *key, uint32_t *value);
+    /* length is the buffer size in, the stored size out */
+    esp_err_t (*get_str)(backend_store_handle_t handle, const char *key, char *value, size_t *length);
+    esp_err_t (*get_blob)(backend_store_handle_t handle, const char *key, void *value, size_t *length);
+    esp_err_t (*set_u8)(backend_store_handle_t handle, const char *key, uint8_t value);
+    esp_err_t (*set_u16)(backend_store_handle_t handle, const char *key, uint16_t value);
+    esp_err_t (*set_u32)(backend_store_handle_t handle, const char *key, uint32_t value);
+    esp_err_t (*set_str)(backend_store_handle_t handle, const char *key, const char *value);
+    esp_err_t (*set_blob)(backend_store_handle_t handle, const char *key, const void *value, size_t length);
+    esp_err_t (*erase)(backend_store_handle_t handle, const char *key);
+    esp_err_t (*commit)(backend_store_handle_t handle);
+} backend_store_t;
+
+typedef struct {
+    const char *name;
+    const backend_pwm_t *pwm;
+    const backend_count_t *count;
+    const backend_store_t *store;
+} backend_t;
+
+extern const backend_pwm_t *pwmBackend;
+extern const backend_count_t *countBackend;
+extern const backend_store_t *storeBackend;
+
+extern const backend_t backendEsp;
+extern const backend_t backendSim;
+
+/* install a backend, e.g. from a host harness, before StartBackend */
+void backend_use(const backend_t *backend);
+/* the configured backend unless one was installed, first thing at boot */
+esp_err_t StartBackend(void);
+
+#endif
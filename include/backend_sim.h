@@ -0,0 +1,23 @@
+#ifndef BACKEND_SIM_H
+#define BACKEND_SIM_H
+
+#include <stdint.h>
+#include <esp_err.h>
+#include "backend.h"
+
+/*
+ * Controls for the simulated backend, for test harnesses and benchmarks. The
+ * outputs only record what they were given, the counters count a pulse
+ * train the harness sets per pin, and the store is a fixed in-memory table.
+ */
+
+/* what the PWM layer last wrote for a channel */
+esp_err_t backend_sim_pwm(uint8_t channel, uint32_t *counts, uint32_t *hpoint);
+/* tach pulses per minute on a pin, i.e. RPM * pulses per revolution */
+void backend_sim_set_pulses(uint8_t pin, uint32_t perMinute);
+/* fire the edge handler registered on a pin, as the GPIO interrupt would */
+void backend_sim_edge(uint8_t pin);
+/* forget everything stored */
+void backend_sim_store_reset(void);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include "target.h"
+
+/*
+ * What is wired where. A build carries a default layout for its target; a
+ * layout saved to NVS replaces it at the next boot. NUM_TARGETS stays the
+ * compile time maximum that every per-channel array is sized for, a board
+ * may use fewer.
+ */
+#define BOARD_VERSION 1
+
+typedef struct {
+    uint8_t pwmPin;
+    uint8_t tachPin;
+    uint8_t ppr;            /* tach pulses per revolution */
+    uint8_t invert;         /* PWM output is active low */
+} boardChannel_t;
+
+typedef struct {
+    uint8_t version;
+    uint8_t channels;       /* in use, <= NUM_TARGETS */
+    boardChannel_t ch[NUM_TARGETS];
+} board_t;
+
+extern board_t board;
+
+/* called by StartConfig once NVS is up, before anything reads the layout */
+esp_err_t loadBoard(void);
+/* validated and written to NVS, used from the next boot */
+esp_err_t saveBoard(const board_t *layout);
+esp_err_t board_validate(const board_t *layout);
+/*
+ * Drop a layout loaded from NVS for the built in one, for when the stored
+ * pins can't be brought up. The stored layout's pins are reset first.
+ * ESP_ERR_INVALID_STATE if the built in one is already in use.
+ */
+esp_err_t board_use_builtin(void);
+
+#endif
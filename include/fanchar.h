@@ -0,0 +1,47 @@
+#ifndef FANCHAR_H
+#define FANCHAR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include "fanduty.h"
+
+/* duty points the sweep measures, 0 - 255 in eighths */
+#define FAN_CHAR_POINTS 9
+/* kept above the measured minimum so a fan near its limit doesn't stall */
+#define FAN_CHAR_MIN_MARGIN 4
+
+/* measured behaviour of the fan on a channel, stored as one NVS blob */
+typedef struct {
+    uint8_t valid;
+    uint8_t minDuty;                    /* lowest duty that kept it turning, stepping down */
+    uint16_t spinupMs;                  /* 0 to 90% of full speed at full duty */
+    uint16_t rpm[FAN_CHAR_POINTS];      /* settled RPM at fanchar_point_duty(i) */
+} fanChar_t;
+
+typedef enum {
+    FAN_CHAR_IDLE = 0,
+    FAN_CHAR_RUNNING,
+    FAN_CHAR_DONE,
+    FAN_CHAR_FAILED,
+} fanCharState_t;
+
+static inline uint8_t fanchar_point_duty(uint8_t point) {
+    return point == FAN_CHAR_POINTS - 1 ? 255 : point * 32;
+}
+
+/* interpolated RPM for a Q16 duty */
+uint32_t fanchar_rpm(const fanChar_t *character, fanDuty_t duty);
+/* lowest Q16 duty expected to reach the RPM, FAN_DUTY_MAX if it can't */
+fanDuty_t fanchar_duty(const fanChar_t *character, uint32_t rpm);
+/* the larger of the configured minimum and the measured one plus margin */
+fanDuty_t fanchar_min_duty(const fanChar_t *character, fanDuty_t configured);
+
+/*
+ * Take the channel away from the control loop and sweep it in the
+ * background. The result is saved with the channel config when it finishes.
+ */
+esp_err_t fanchar_start(uint8_t channel);
+fanCharState_t fanchar_state(uint8_t channel);
+
+#endif
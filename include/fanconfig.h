@@ -4,16 +4,45 @@
 #include <stdio.h>
 #include <esp_err.h>
 #include "target.h"
+#include "fancurve.h"
+#include "fanpid.h"
+#include "fanlimit.h"
+#include "fanchar.h"
 
 #define DEF_LOW_TEMP 55
 #define DEF_HIGH_TEMP 80
 #define DEF_LOW_DUTY 10
+#define DEF_MAX_RPM 3000
+#define DEF_FAILSAFE_TIMEOUT 5000
+#define DEF_HYSTERESIS 10
+#define DEF_MIN_STEP 2
+#define DEF_SLEW_RATE 0
+#define DEF_FADE_RATE 85
+#define DEF_KICK_MS 1000
+#define DEF_PID_KP 0.5
+#define DEF_PID_KI 0.5
+#define DEF_PID_KD 0
+
+typedef enum {
+    CHANNEL_MODE_CURVE = 0,     /* fan curve drives the duty directly */
+    CHANNEL_MODE_PID = 1,       /* fan curve sets a target RPM, PID drives the duty */
+} channelMode_t;
 
 typedef struct {
     bool enabled;
     uint32_t lowTemp;
     uint32_t highTemp;
     uint8_t minDuty;
+    uint8_t curvePoints;                        /* 0 = linear lowTemp -> highTemp */
+    fanCurvePoint_t curve[FAN_CURVE_MAX_POINTS];
+    uint8_t mode;                               /* channelMode_t */
+    uint32_t maxRPM;                            /* RPM at full duty, scales the curve in PID mode */
+    fanPidGains_t pid;
+    uint32_t failsafeTimeout;                   /* ms without a temperature before forcing full duty, 0 = off */
+    fanLimits_t limits;                         /* hysteresis/deadband/slew applied to curve mode duty changes */
+    uint16_t fadeRate;                          /* duty (0-255) per second the output fades at in curve mode, 0 = immediate */
+    uint16_t kickMs;                            /* full duty kick when starting from rest, 0 = off */
+    fanChar_t character;                        /* measured by the characterisation sweep, valid = 0 if never run */
 } channelConfig_t;
 
 channelConfig_t channelConfig[NUM_TARGETS];
@@ -15,6 +15,18 @@ enum {
     TIME_EVENT_SYNC,      
 };
 
+ESP_EVENT_DECLARE_BASE(TARGET_EVENTS);      // per-channel control events, data is the uint8_t channel
+
+enum {
+    TARGET_EVENT_STALE,         // no temperature within the channel's failsafe timeout
+    TARGET_EVENT_RECOVERED,     // temperature updates resumed after going stale
+    /* fan health changes, in fanHealth_t order */
+    TARGET_EVENT_FAN_OK,            // fan back to the speed its duty should give
+    TARGET_EVENT_FAN_DEGRADED,      // fan turning well below its expected speed
+    TARGET_EVENT_FAN_STALLED,       // fan stopped while still driven
+    TARGET_EVENT_FAN_SPINUP_FAILED, // fan driven from rest never started
+};
+
 
 
 #ifdef __cplusplus
@@ -0,0 +1,47 @@
+#ifndef FANCURVE_H
+#define FANCURVE_H
+
+#include <stdint.h>
+#include <math.h>
+#include "target.h"
+#include "fanduty.h"
+
+/* the compiled table covers 0 - FAN_CURVE_MAX_TEMP in 1/FAN_CURVE_STEPS_PER_DEGREE steps */
+#define FAN_CURVE_STEPS_PER_DEGREE 4
+#define FAN_CURVE_MAX_TEMP 120
+#define FAN_CURVE_LUT_SIZE (FAN_CURVE_MAX_TEMP * FAN_CURVE_STEPS_PER_DEGREE + 1)
+
+#define FAN_CURVE_MAX_POINTS 8
+
+typedef struct {
+    uint8_t temp;
+    uint8_t duty;
+} fanCurvePoint_t;
+
+extern fanDuty_t fanCurveTable[NUM_TARGETS][FAN_CURVE_LUT_SIZE];
+
+/* 
+ * Build the lookup table for a channel from its curve points. With no points
+ * the curve is the classic lowTemp (off) -> highTemp (full) ramp. Below the
+ * first point the fan is off, inside the curve the duty never drops below
+ * minDuty, and above the last point the last duty is held. Points are on
+ * the 0-255 scale, the table holds Q16 duty.
+ */
+void fancurve_compile(uint8_t channel, const fanCurvePoint_t *points, uint8_t numPoints, uint32_t lowTemp, uint32_t highTemp, fanDuty_t minDuty);
+
+static inline fanDuty_t fancurve_lookup(uint8_t channel, float temp) {
+    /* a reading that isn't a number is no reason to stop the fan, range checked before the float is cast */
+    if (isnan(temp)) {
+        return FAN_DUTY_MAX;
+    }
+    if (temp <= 0) {
+        return fanCurveTable[channel][0];
+    }
+    float scaled = temp * FAN_CURVE_STEPS_PER_DEGREE + 0.5f;
+    if (scaled >= FAN_CURVE_LUT_SIZE) {
+        return FAN_DUTY_MAX;
+    }
+    return fanCurveTable[channel][(uint32_t)scaled];
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef FANDUTY_H
+#define FANDUTY_H
+
+#include <stdint.h>
+
+/*
+ * Duty travels from the curve to the LEDC as a Q16 fraction of full scale:
+ * 0 is off and FAN_DUTY_MAX is fully on. Only the PWM driver turns it into
+ * timer counts, so changing the timer resolution changes nothing above it.
+ * Stored config and the older protocol fields keep the 0-255 scale and are
+ * converted at the edge.
+ */
+typedef uint16_t fanDuty_t;
+
+#define FAN_DUTY_MAX 0xFFFF
+
+#define FAN_DUTY_FROM_U8(d) ((fanDuty_t)((uint32_t)(d) * 257))
+#define FAN_DUTY_TO_U8(d) ((uint8_t)(((uint32_t)(d) + 128) / 257))
+#define FAN_DUTY_TO_PERMILLE(d) ((uint16_t)(((uint32_t)(d) * 1000 + FAN_DUTY_MAX / 2) / FAN_DUTY_MAX))
+#define FAN_DUTY_FROM_PERMILLE(p) ((fanDuty_t)(((uint32_t)(p) * FAN_DUTY_MAX + 500) / 1000))
+
+/* a 0-255 duty from the protocol or REST, keeping any fraction */
+static inline fanDuty_t fan_duty_from_float(float duty) {
+    if (!(duty > 0)) {
+        return 0;
+    }
+    if (duty >= 255) {
+        return FAN_DUTY_MAX;
+    }
+    return (fanDuty_t)(duty * 257 + 0.5f);
+}
+
+#endif
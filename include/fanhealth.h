@@ -0,0 +1,50 @@
+#ifndef FANHEALTH_H
+#define FANHEALTH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fanduty.h"
+
+typedef enum {
+    FAN_HEALTH_OK = 0,
+    FAN_HEALTH_DEGRADED,        /* turning, but well below the speed its duty should give */
+    FAN_HEALTH_STALLED,         /* was turning and stopped while still driven */
+    FAN_HEALTH_SPINUP_FAILED,   /* driven from rest and never started */
+} fanHealth_t;
+
+/* a fan is only judged once it has had this long to settle on a new duty */
+#define FAN_HEALTH_SETTLE_US        3000000
+/* below this duty many fans legitimately stop, so a zero reading proves nothing */
+#define FAN_HEALTH_MIN_DUTY         (FAN_DUTY_MAX / 5)
+/* consecutive zero readings from a turning fan before it is called stalled */
+#define FAN_HEALTH_STALL_SAMPLES    2
+/* measured / expected RPM, permille, to enter and leave degraded */
+#define FAN_HEALTH_DEGRADED_BELOW   700
+#define FAN_HEALTH_RECOVERED_ABOVE  800
+/* weight of a new ratio sample, as a shift: 1/8 */
+#define FAN_HEALTH_RATIO_SHIFT      3
+/* duty added to every other channel for each fan that has stalled or failed to start */
+#define FAN_HEALTH_COMPENSATE       (FAN_DUTY_MAX / 4)
+
+typedef struct {
+    uint8_t status;             /* fanHealth_t */
+    fanDuty_t duty;             /* last commanded duty */
+    int64_t dutyAt;             /* us when the commanded duty last changed */
+    bool spinning;              /* seen turning since it was last started from rest */
+    uint8_t zeroSamples;
+    uint16_t ratio;             /* smoothed measured / expected RPM, permille, 0 = no history */
+} fanHealthState_t;
+
+void fanhealth_reset(fanHealthState_t *state, fanDuty_t duty, int64_t now);
+/* the commanded duty changed. Returns true if the status changed, a stop clears it */
+bool fanhealth_duty(fanHealthState_t *state, fanDuty_t duty, int64_t now);
+/*
+ * Feed one RPM reading, with the RPM the commanded duty should give.
+ * Constant time, no allocation. Returns true if the status changed.
+ */
+bool fanhealth_sample(fanHealthState_t *state, uint32_t rpm, uint32_t expected, int64_t now);
+/* the output stage gave up kicking a fan from rest. Returns true if the status changed */
+bool fanhealth_kick_failed(fanHealthState_t *state);
+const char *fanhealth_name(uint8_t status);
+
+#endif
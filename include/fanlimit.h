@@ -0,0 +1,28 @@
+#ifndef FANLIMIT_H
+#define FANLIMIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fanduty.h"
+
+typedef struct {
+    uint16_t hysteresis;        /* 0.1 C the temperature must move from the last change */
+    uint8_t minStep;            /* smallest duty change worth applying, 0-255 scale */
+    uint16_t slewRate;          /* max duty change per second on the 0-255 scale, 0 = unlimited */
+} fanLimits_t;
+
+typedef struct {
+    float appliedTemp;          /* temperature when the duty last changed */
+    int64_t appliedAt;          /* us when the duty last changed */
+    bool pending;               /* slew limited - call again to keep moving */
+} fanLimitState_t;
+
+/*
+ * Filter a newly calculated duty. Returns the duty to apply, which equals
+ * current when the change is suppressed. Moves to 0 or full scale bypass the
+ * deadband and step checks so the fan can always fully stop or reach full
+ * speed, though they are still slew limited.
+ */
+fanDuty_t fanlimit_apply(fanLimitState_t *state, const fanLimits_t *limits, fanDuty_t current, fanDuty_t wanted, float temp, int64_t now);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef FANPID_H
+#define FANPID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fanduty.h"
+
+typedef struct {
+    float kp;       /* duty fraction per unit of normalised RPM error */
+    float ki;       /* per second */
+    float kd;       /* seconds */
+} fanPidGains_t;
+
+typedef struct {
+    float integral;
+    float prevError;
+    bool primed;
+} fanPidState_t;
+
+void fanpid_reset(fanPidState_t *state);
+
+/*
+ * One step of the RPM loop. setpoint and measured are in RPM, normalised
+ * against maxRPM so the same gains suit fans of different speeds. feedForward
+ * is the open-loop duty the loop trims around. The result is clamped to
+ * [minDuty, FAN_DUTY_MAX], and the integrator stops accumulating while the output is
+ * pinned against a limit in the direction of the error.
+ */
+fanDuty_t fanpid_step(fanPidState_t *state, const fanPidGains_t *gains, uint32_t setpoint, uint32_t measured,
+                      uint32_t maxRPM, fanDuty_t feedForward, float dt, fanDuty_t minDuty);
+
+#endif
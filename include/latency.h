@@ -0,0 +1,44 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+typedef enum {
+    LATENCY_STAGE_QUEUE = 0,    /* ingress -> picked up by the target task */
+    LATENCY_STAGE_CALC,         /* picked up -> duty calculated */
+    LATENCY_STAGE_APPLY,        /* duty calculated -> written to the LEDC */
+    LATENCY_STAGE_TOTAL,        /* ingress -> written to the LEDC */
+    LATENCY_STAGE_TACHO_WAKE,   /* tacho tick due -> tacho task running */
+    LATENCY_STAGE_TACHO_GATE,   /* |measured gate - nominal gate| */
+    LATENCY_STAGE_MAX
+} latency_stage_t;
+
+/*
+ * Log-linear histogram of microseconds: values below LATENCY_SUB_BUCKETS get
+ * a bucket each, above that every power of two is split into
+ * LATENCY_SUB_BUCKETS linear buckets (<= 25% error). The last bucket
+ * collects everything from ~16s up.
+ */
+#define LATENCY_SUB_BITS 2
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS (LATENCY_SUB_BUCKETS * 24)
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[LATENCY_BUCKETS];
+} latency_hist_t;
+
+void latency_record(latency_stage_t stage, uint32_t us);
+void latency_get(latency_stage_t stage, latency_hist_t *hist);
+void latency_reset(void);
+const char *latency_stage_name(latency_stage_t stage);
+
+/* upper bound in us of the values counted in a bucket */
+uint32_t latency_bucket_limit(uint8_t bucket);
+
+/* estimated value (us) below which the given permille of samples fall */
+uint32_t latency_percentile(const latency_hist_t *hist, uint16_t permille);
+
+#endif
@@ -1,12 +1,45 @@
 #ifndef PWM_H
 #define PWM_H
 
-#define LEDC_TEST_CH_NUM       (6)
-#define LEDC_TEST_DUTY         (26000)
-#define LEDC_TEST_FADE_TIME    (3000)
+#include <stdbool.h>
+#include "fanduty.h"
 
+/* period of the software fade engine */
+#define PWM_FADE_TICK_MS        20
+/* Q16 per second, full range in 3 s until the channel config sets its own */
+#define PWM_FADE_RATE_DEFAULT   (FAN_DUTY_MAX / 3)
+/* full duty kick when a fan starts from rest, until the channel config sets its own */
+#define PWM_KICK_MS_DEFAULT     1000
+/* a tach reading ends the kick early, but not before this fraction of it */
+#define PWM_KICK_MIN_DIVISOR    4
+/* minimum gap between two channels' kicks */
+#define PWM_KICK_STAGGER_MS     250
+/* kicks tried before the start is given up on and the channel held at full duty */
+#define PWM_KICK_RETRIES        3
+
+/* again after board_use_builtin to move the outputs to the new layout */
 esp_err_t StartPWM(void);
-esp_err_t pwm_set_duty(uint8_t channel, uint8_t duty);
-uint8_t pwm_get_duty(uint8_t channel);
+/* duty is Q16 full scale, scaled to the configured timer resolution here */
+esp_err_t pwm_set_duty(uint8_t channel, fanDuty_t duty);
+esp_err_t pwm_set_duty_immediate(uint8_t channel, fanDuty_t duty);
+/* fade rate in Q16 per second for pwm_set_duty, 0 makes it immediate too */
+esp_err_t pwm_set_fade_rate(uint8_t channel, uint32_t rate);
+/* full duty kick length when the channel starts from rest, 0 turns it off */
+esp_err_t pwm_set_kick(uint8_t channel, uint16_t ms);
+/* tach feedback, confirms a kick has the fan turning */
+void pwm_note_rpm(uint8_t channel, uint32_t rpm);
+/* every kick ran its full length without a tach reading, the output is held at full duty */
+bool pwm_kick_failed(uint8_t channel);
+/* the duty the output is driving now, part way through any fade */
+fanDuty_t pwm_get_duty(uint8_t channel);
+/* where the fade is heading */
+fanDuty_t pwm_get_target(uint8_t channel);
+/*
+ * Group update: duty changes made between begin and commit are written out
+ * together at commit, with the phases laid out once for the new set, and no
+ * fade tick can land in between. Only for the task that called begin.
+ */
+void pwm_group_begin(void);
+esp_err_t pwm_group_commit(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,93 @@
+#ifndef RXRING_H
+#define RXRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Per-connection receive ring. The socket is drained into it with one recv
+ * per wake-up and frames are parsed out of it in place, so several queued
+ * messages cost one syscall and a frame may arrive in any number of pieces.
+ * head and tail are free running byte counts, the buffer index is the count
+ * modulo RX_RING_SIZE.
+ */
+#define RX_RING_SIZE 2048
+
+typedef struct {
+    uint8_t buf[RX_RING_SIZE];
+    uint32_t head;              /* bytes received */
+    uint32_t tail;              /* bytes consumed */
+} rxring_t;
+
+static inline void rxring_reset(rxring_t *ring) {
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+static inline uint32_t rxring_used(const rxring_t *ring) {
+    return ring->head - ring->tail;
+}
+
+/* the largest contiguous free space, for recv to fill directly */
+static inline uint8_t *rxring_write_ptr(rxring_t *ring, size_t *space) {
+    if (ring->head == ring->tail) {
+        /* empty - start again at the front so a whole frame fits without wrapping */
+        rxring_reset(ring);
+    }
+    uint32_t at = ring->head % RX_RING_SIZE;
+    uint32_t free = RX_RING_SIZE - rxring_used(ring);
+    *space = free < RX_RING_SIZE - at ? free : RX_RING_SIZE - at;
+    return &ring->buf[at];
+}
+
+static inline void rxring_produce(rxring_t *ring, size_t len) {
+    ring->head += len;
+}
+
+/* copy len bytes starting offset bytes past the tail, without consuming them */
+static inline void rxring_peek(const rxring_t *ring, uint32_t offset, void *out, size_t len) {
+    uint32_t at = (ring->tail + offset) % RX_RING_SIZE;
+    size_t first = len < RX_RING_SIZE - at ? len : RX_RING_SIZE - at;
+    memcpy(out, &ring->buf[at], first);
+    memcpy((uint8_t *)out + first, ring->buf, len - first);
+}
+
+/* where len bytes starting offset bytes past the tail sit, or NULL if they wrap the end */
+static inline const uint8_t *rxring_span(const rxring_t *ring, uint32_t offset, size_t len) {
+    uint32_t at = (ring->tail + offset) % RX_RING_SIZE;
+    return len <= RX_RING_SIZE - at ? &ring->buf[at] : NULL;
+}
+
+static inline void rxring_consume(rxring_t *ring, size_t len) {
+    ring->tail += len;
+}
+
+/*
+ * Frames on the ring are a 4 byte big endian body length then the body.
+ * The header and body have to fit in the ring together.
+ */
+#define RX_FRAME_HEADER 4
+#define RX_FRAME_MAX (RX_RING_SIZE - RX_FRAME_HEADER)
+
+typedef enum {
+    RX_FRAME_PARTIAL = 0,       /* wait for more */
+    RX_FRAME_READY,             /* a whole frame is buffered, its body starts RX_FRAME_HEADER past the tail */
+    RX_FRAME_INVALID,           /* the header can't be honoured, drop the connection */
+} rxframe_t;
+
+/* look at the frame at the tail, len is the announced body length once the header is in */
+static inline rxframe_t rxring_frame(const rxring_t *ring, uint32_t *len) {
+    uint8_t header[RX_FRAME_HEADER];
+    if (rxring_used(ring) < RX_FRAME_HEADER) {
+        return RX_FRAME_PARTIAL;
+    }
+    rxring_peek(ring, 0, header, RX_FRAME_HEADER);
+    *len = (uint32_t)header[0] << 24 | (uint32_t)header[1] << 16 | (uint32_t)header[2] << 8 | header[3];
+    if (*len > RX_FRAME_MAX) {
+        return RX_FRAME_INVALID;
+    }
+    return rxring_used(ring) - RX_FRAME_HEADER < *len ? RX_FRAME_PARTIAL : RX_FRAME_READY;
+}
+
+#endif
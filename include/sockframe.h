@@ -0,0 +1,17 @@
+#ifndef SOCKFRAME_H
+#define SOCKFRAME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rxring.h"
+#include "espmsg.pb.h"
+
+/*
+ * Decode the request frame body at offset in the ring without copying it
+ * out first. A contiguous body is decoded straight from the ring memory, a
+ * body that wraps the end is read through a stream callback. An empty body
+ * is refused, it would otherwise decode to a default request.
+ */
+bool sock_decode(const rxring_t *ring, uint32_t offset, uint32_t len, espmsg_EspReq_Msg *request);
+
+#endif
@@ -1,8 +1,27 @@
 #ifndef TACHO_H
 #define TACHO_H
 
+#include <stdint.h>
+#include <esp_err.h>
+
+typedef struct {
+    uint32_t window;    /* us of signal behind the latest reading */
+    uint32_t rate;      /* readings per 1000 s for this channel */
+    uint32_t error;     /* worst case error of the latest reading, RPM */
+} tacho_stats_t;
+
+/* raw readings kept per channel for diagnostics, before any filtering */
+#define TACHO_RAW_SAMPLES 16
+
+typedef struct {
+    uint32_t time;      /* ms since boot */
+    uint32_t rpm;
+} tacho_sample_t;
 
 esp_err_t StartTacho();
+esp_err_t tacho_get_stats(uint8_t channel, tacho_stats_t *stats);
+/* copy out up to TACHO_RAW_SAMPLES raw readings, oldest first */
+esp_err_t tacho_get_raw(uint8_t channel, tacho_sample_t samples[TACHO_RAW_SAMPLES], uint8_t *count);
 
 
 #endif
\ No newline at end of file
@@ -1,23 +1,49 @@
 #ifndef TARGET_H
 #define TARGET_H
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <esp_err.h>
+#include "fanduty.h"
+
 #define NUM_TARGETS 6
 
 typedef struct {
     uint8_t channel;
-    uint8_t duty;
+    fanDuty_t duty;         /* Q16, see fanduty.h */
     float temp;
     uint32_t rpm;
     float load;
     time_t lastUpdate;
+    uint32_t targetRPM;     /* PID mode setpoint */
+    bool stale;             /* no temperature within failsafeTimeout - held at full duty */
+    uint8_t health;         /* fanHealth_t from the stall / degradation detector */
 } target_t;
 
+typedef struct {
+    uint32_t posted;            /* updates written into the channel mailboxes */
+    uint32_t coalesced;         /* updates that replaced a value not yet processed */
+    uint32_t suppressed;        /* duty changes held back by hysteresis, min step or slew rate */
+    uint32_t wakeups;           /* target task passes */
+    uint32_t drained;           /* mailbox updates handled across all passes */
+    uint32_t applied;           /* PWM writes issued at the end of a pass */
+} target_stats_t;
+
 esp_err_t StartTarget(void);
 esp_err_t target_send_temp(uint8_t channel, float temp);
-esp_err_t target_send_duty(uint8_t channel, uint8_t duty);
+esp_err_t target_send_duty(uint8_t channel, fanDuty_t duty);
+/* as above, with the esp_timer time the value arrived for latency tracking */
+esp_err_t target_send_temp_stamped(uint8_t channel, float temp, int64_t ingress);
+esp_err_t target_send_duty_stamped(uint8_t channel, fanDuty_t duty, int64_t ingress);
 esp_err_t target_send_load(uint8_t channel, float load);
 esp_err_t target_send_rpm(uint8_t channel, uint32_t rpm);
+esp_err_t target_send_config(uint8_t channel);
 
 esp_err_t target_get_data(uint8_t channel, target_t *data);
+esp_err_t target_get_all(target_t data[NUM_TARGETS]);
+esp_err_t target_get_stats(target_stats_t *stats);
+/* while held the target task keeps computing but leaves the channel's PWM alone */
+esp_err_t target_hold(uint8_t channel, bool hold);
 
 #endif
\ No newline at end of file
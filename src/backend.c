@@ -0,0 +1,31 @@
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include "backend.h"
+
+static const char* TAG = "Backend";
+
+const backend_pwm_t *pwmBackend;
+const backend_count_t *countBackend;
+const backend_store_t *storeBackend;
+static const char *backendName;
+
+void backend_use(const backend_t *backend) {
+    pwmBackend = backend->pwm;
+    countBackend = backend->count;
+    storeBackend = backend->store;
+    backendName = backend->name;
+}
+
+esp_err_t StartBackend(void) {
+    if (backendName == NULL) {
+#if CONFIG_FANCTRL_BACKEND_SIM
+        backend_use(&backendSim);
+#else
+        backend_use(&backendEsp);
+#endif
+    }
+    ESP_LOGI(TAG, "Using the %s backend", backendName);
+    return storeBackend->init();
+}
@@ -0,0 +1,258 @@
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <driver/ledc.h>
+#include <driver/pcnt.h>
+#include <driver/gpio.h>
+#include <soc/soc_caps.h>
+#include "nvs_flash.h"
+#include "backend.h"
+#include "target.h"
+
+static const char* TAG = "BackendEsp";
+
+/*
+ * PWM on the LEDC. Every fan channel is on one timer so they share
+ * frequency and resolution; polarity is set in the output stage so duty
+ * always means the same thing above here.
+ */
+#define LEDC_HS_TIMER          LEDC_TIMER_0
+#ifdef CONFIG_IDF_TARGET_ESP32
+#define LEDC_HS_MODE           LEDC_HIGH_SPEED_MODE
+#elif CONFIG_IDF_TARGET_ESP32S3
+#define LEDC_HS_MODE           LEDC_LOW_SPEED_MODE
+#endif
+/* LEDC channel behind each fan channel */
+static const ledc_channel_t ledcChannel[NUM_TARGETS] = {
+    LEDC_CHANNEL_0,
+    LEDC_CHANNEL_1,
+    LEDC_CHANNEL_2,
+    LEDC_CHANNEL_3,
+    LEDC_CHANNEL_4,
+    LEDC_CHANNEL_6,
+};
+
+static esp_err_t esp_pwm_timer(uint32_t freqHz, uint8_t bits) {
+    ledc_timer_config_t ledc_timer = {
+        .duty_resolution = bits,
+        .freq_hz = freqHz,
+        .speed_mode = LEDC_HS_MODE,
+        .timer_num = LEDC_HS_TIMER,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+    return ledc_timer_config(&ledc_timer);
+}
+
+static esp_err_t esp_pwm_channel(uint8_t channel, uint8_t pin, bool invert, uint32_t counts) {
+    if (channel >= NUM_TARGETS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ESP_LOGD(TAG, "Setting up LEDC Channel %d on GPIO %d", channel, pin);
+    ledc_channel_config_t config = {
+        .channel    = ledcChannel[channel],
+        .duty       = counts,
+        .gpio_num   = pin,
+        .speed_mode = LEDC_HS_MODE,
+        .hpoint     = 0,
+        .timer_sel  = LEDC_HS_TIMER,
+        .flags.output_invert = invert
+    };
+    return ledc_channel_config(&config);
+}
+
+static esp_err_t esp_pwm_write(uint8_t channel, uint32_t counts, uint32_t hpoint) {
+    return ledc_set_duty_and_update(LEDC_HS_MODE, ledcChannel[channel], counts, hpoint);
+}
+
+static const backend_pwm_t espPwm = {
+    .timer = esp_pwm_timer,
+    .channel = esp_pwm_channel,
+    .write = esp_pwm_write,
+};
+
+/* pulse counting on the PCNT, edges on the GPIO interrupt service */
+static esp_err_t esp_count_setup(uint8_t unit, uint8_t pin, int16_t limit) {
+    pcnt_config_t pcnt_config = {
+        .pulse_gpio_num = pin,
+        .ctrl_gpio_num = PCNT_PIN_NOT_USED,
+        .channel = PCNT_CHANNEL_0,
+        .unit = PCNT_UNIT_0 + unit,
+        .pos_mode = PCNT_COUNT_DIS,
+        .neg_mode = PCNT_COUNT_INC,
+        .lctrl_mode = PCNT_MODE_KEEP,
+        .hctrl_mode = PCNT_MODE_KEEP,
+        .counter_h_lim = limit,
+        .counter_l_lim = 0,
+    };
+    esp_err_t err = pcnt_unit_config(&pcnt_config);
+    if (err == ESP_OK) {
+        err = pcnt_set_filter_value(PCNT_UNIT_0 + unit, 1023);
+    }
+    if (err == ESP_OK) {
+        err = pcnt_filter_enable(PCNT_UNIT_0 + unit);
+    }
+    if (err == ESP_OK) {
+        err = pcnt_counter_pause(PCNT_UNIT_0 + unit);
+    }
+    if (err == ESP_OK) {
+        err = pcnt_counter_clear(PCNT_UNIT_0 + unit);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set up PCNT unit %d on GPIO %d: %s", unit, pin, esp_err_to_name(err));
+    }
+    return err;
+}
+
+static esp_err_t esp_count_read(uint8_t unit, int16_t *count) {
+    return pcnt_get_counter_value(PCNT_UNIT_0 + unit, count);
+}
+
+static esp_err_t esp_count_pause(uint8_t unit) {
+    return pcnt_counter_pause(PCNT_UNIT_0 + unit);
+}
+
+static esp_err_t esp_count_resume(uint8_t unit) {
+    return pcnt_counter_resume(PCNT_UNIT_0 + unit);
+}
+
+static esp_err_t esp_count_clear(uint8_t unit) {
+    return pcnt_counter_clear(PCNT_UNIT_0 + unit);
+}
+
+static esp_err_t esp_count_set_pin(uint8_t unit, uint8_t pin) {
+    return pcnt_set_pin(PCNT_UNIT_0 + unit, PCNT_CHANNEL_0, pin, PCNT_PIN_NOT_USED);
+}
+
+static esp_err_t esp_count_edges(uint8_t pin, void (*isr)(void *arg), void *arg) {
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << pin,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    esp_err_t err = gpio_config(&io_conf);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to install GPIO ISR service: %s", esp_err_to_name(err));
+        return err;
+    }
+    return gpio_isr_handler_add(pin, isr, arg);
+}
+
+static const backend_count_t espCount = {
+    .units = SOC_PCNT_UNITS_PER_GROUP,
+    .setup = esp_count_setup,
+    .read = esp_count_read,
+    .pause = esp_count_pause,
+    .resume = esp_count_resume,
+    .clear = esp_count_clear,
+    .set_pin = esp_count_set_pin,
+    .edges = esp_count_edges,
+};
+
+/* storage in NVS, with its not found folded into the generic one */
+static inline esp_err_t esp_store_err(esp_err_t err) {
+    return err == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : err;
+}
+
+static esp_err_t esp_store_init(void) {
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        /* NVS partition was truncated
+         * and needs to be erased */
+        ret = nvs_flash_erase();
+        if (ret != ESP_OK) {
+            return ret;
+        }
+
+        /* Retry nvs_flash_init */
+        ret = nvs_flash_init();
+    }
+    return ret;
+}
+
+static esp_err_t esp_store_open(const char *space, backend_store_handle_t *handle) {
+    return esp_store_err(nvs_open(space, NVS_READWRITE, handle));
+}
+
+static void esp_store_close(backend_store_handle_t handle) {
+    nvs_close(handle);
+}
+
+static esp_err_t esp_store_get_u8(backend_store_handle_t handle, const char *key, uint8_t *value) {
+    return esp_store_err(nvs_get_u8(handle, key, value));
+}
+
+static esp_err_t esp_store_get_u16(backend_store_handle_t handle, const char *key, uint16_t *value) {
+    return esp_store_err(nvs_get_u16(handle, key, value));
+}
+
+static esp_err_t esp_store_get_u32(backend_store_handle_t handle, const char *key, uint32_t *value) {
+    return esp_store_err(nvs_get_u32(handle, key, value));
+}
+
+static esp_err_t esp_store_get_str(backend_store_handle_t handle, const char *key, char *value, size_t *length) {
+    return esp_store_err(nvs_get_str(handle, key, value, length));
+}
+
+static esp_err_t esp_store_get_blob(backend_store_handle_t handle, const char *key, void *value, size_t *length) {
+    return esp_store_err(nvs_get_blob(handle, key, value, length));
+}
+
+static esp_err_t esp_store_set_u8(backend_store_handle_t handle, const char *key, uint8_t value) {
+    return nvs_set_u8(handle, key, value);
+}
+
+static esp_err_t esp_store_set_u16(backend_store_handle_t handle, const char *key, uint16_t value) {
+    return nvs_set_u16(handle, key, value);
+}
+
+static esp_err_t esp_store_set_u32(backend_store_handle_t handle, const char *key, uint32_t value) {
+    return nvs_set_u32(handle, key, value);
+}
+
+static esp_err_t esp_store_set_str(backend_store_handle_t handle, const char *key, const char *value) {
+    return nvs_set_str(handle, key, value);
+}
+
+static esp_err_t esp_store_set_blob(backend_store_handle_t handle, const char *key, const void *value, size_t length) {
+    return nvs_set_blob(handle, key, value, length);
+}
+
+static esp_err_t esp_store_erase(backend_store_handle_t handle, const char *key) {
+    return esp_store_err(nvs_erase_key(handle, key));
+}
+
+static esp_err_t esp_store_commit(backend_store_handle_t handle) {
+    return nvs_commit(handle);
+}
+
+static const backend_store_t espStore = {
+    .init = esp_store_init,
+    .open = esp_store_open,
+    .close = esp_store_close,
+    .get_u8 = esp_store_get_u8,
+    .get_u16 = esp_store_get_u16,
+    .get_u32 = esp_store_get_u32,
+    .get_str = esp_store_get_str,
+    .get_blob = esp_store_get_blob,
+    .set_u8 = esp_store_set_u8,
+    .set_u16 = esp_store_set_u16,
+    .set_u32 = esp_store_set_u32,
+    .set_str = esp_store_set_str,
+    .set_blob = esp_store_set_blob,
+    .erase = esp_store_erase,
+    .commit = esp_store_commit,
+};
+
+const backend_t backendEsp = {
+    .name = "ESP-IDF",
+    .pwm = &espPwm,
+    .count = &espCount,
+    .store = &espStore,
+};
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <string.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "backend.h"
+#include "backend_sim.h"
+#include "target.h"
+
+static const char* TAG = "BackendSim";
+
+#define SIM_PINS                64
+#define SIM_STORE_SPACES        16
+#define SIM_STORE_ENTRIES       160
+#define SIM_STORE_NAME          16      /* NVS limits names to 15 characters too */
+#define SIM_STORE_VALUE         64
+
+/* PWM: remember the last write per channel */
+typedef struct {
+    uint32_t counts;
+    uint32_t hpoint;
+    uint8_t pin;
+    bool invert;
+} sim_pwm_t;
+
+static sim_pwm_t simPwm[NUM_TARGETS];
+
+static esp_err_t sim_pwm_timer(uint32_t freqHz, uint8_t bits) {
+    ESP_LOGI(TAG, "PWM timer %d Hz, %d bit", freqHz, bits);
+    return ESP_OK;
+}
+
+static esp_err_t sim_pwm_channel(uint8_t channel, uint8_t pin, bool invert, uint32_t counts) {
+    if (channel >= NUM_TARGETS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    simPwm[channel] = (sim_pwm_t) { .counts = counts, .hpoint = 0, .pin = pin, .invert = invert };
+    return ESP_OK;
+}
+
+static esp_err_t sim_pwm_write(uint8_t channel, uint32_t counts, uint32_t hpoint) {
+    simPwm[channel].counts = counts;
+    simPwm[channel].hpoint = hpoint;
+    return ESP_OK;
+}
+
+esp_err_t backend_sim_pwm(uint8_t channel, uint32_t *counts, uint32_t *hpoint) {
+    if (channel >= NUM_TARGETS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *counts = simPwm[channel].counts;
+    *hpoint = simPwm[channel].hpoint;
+    return ESP_OK;
+}
+
+static const backend_pwm_t simPwmOps = {
+    .timer = sim_pwm_timer,
+    .channel = sim_pwm_channel,
+    .write = sim_pwm_write,
+};
+
+/*
+ * Counters: each unit integrates the pulse rate of the pin it is on while
+ * it runs, in pulse-microseconds per second so slow rates don't round away.
+ */
+typedef struct {
+    uint8_t pin;
+    int16_t limit;
+    bool running;
+    int64_t at;                 /* us the accumulator was last brought up to date */
+    uint64_t accum;             /* pulses * 60000000 */
+} sim_unit_t;
+
+static sim_unit_t simUnit[NUM_TARGETS];
+static uint32_t simPulses[SIM_PINS];        /* per minute */
+static void (*simIsr[SIM_PINS])(void *arg);
+static void *simIsrArg[SIM_PINS];
+
+static void sim_unit_update(sim_unit_t *u) {
+    int64_t now = esp_timer_get_time();
+    if (u->running) {
+        u->accum += (uint64_t)simPulses[u->pin] * (now - u->at);
+    }
+    u->at = now;
+}
+
+static esp_err_t sim_count_setup(uint8_t unit, uint8_t pin, int16_t limit) {
+    if (unit >= NUM_TARGETS || pin >= SIM_PINS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    simUnit[unit] = (sim_unit_t) { .pin = pin, .limit = limit, .running = false, .at = esp_timer_get_time() };
+    return ESP_OK;
+}
+
+static esp_err_t sim_count_read(uint8_t unit, int16_t *count) {
+    sim_unit_update(&simUnit[unit]);
+    uint64_t pulses = simUnit[unit].accum / 60000000;
+    *count = simUnit[unit].limit > 0 ? pulses % simUnit[unit].limit : (int16_t)pulses;
+    return ESP_OK;
+}
+
+static esp_err_t sim_count_pause(uint8_t unit) {
+    sim_unit_update(&simUnit[unit]);
+    simUnit[unit].running = false;
+    return ESP_OK;
+}
+
+static esp_err_t sim_count_resume(uint8_t unit) {
+    sim_unit_update(&simUnit[unit]);
+    simUnit[unit].running = true;
+    return ESP_OK;
+}
+
+static esp_err_t sim_count_clear(uint8_t unit) {
+    sim_unit_update(&simUnit[unit]);
+    simUnit[unit].accum = 0;
+    return ESP_OK;
+}
+
+static esp_err_t sim_count_set_pin(uint8_t unit, uint8_t pin) {
+    if (pin >= SIM_PINS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_unit_update(&simUnit[unit]);
+    simUnit[unit].pin = pin;
+    return ESP_OK;
+}
+
+static esp_err_t sim_count_edges(uint8_t pin, void (*isr)(void *arg), void *arg) {
+    if (pin >= SIM_PINS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    simIsrArg[pin] = arg;
+    simIsr[pin] = isr;
+    return ESP_OK;
+}
+
+void backend_sim_set_pulses(uint8_t pin, uint32_t perMinute) {
+    if (pin >= SIM_PINS) {
+        return;
+    }
+    /* bring every unit on the pin up to date at the old rate first */
+    for (uint8_t i = 0; i < NUM_TARGETS; i++) {
+        if (simUnit[i].pin == pin) {
+            sim_unit_update(&simUnit[i]);
+        }
+    }
+    simPulses[pin] = perMinute;
+}
+
+void backend_sim_edge(uint8_t pin) {
+    if (pin < SIM_PINS && simIsr[pin] != NULL) {
+        simIsr[pin](simIsrArg[pin]);
+    }
+}
+
+static const backend_count_t simCountOps = {
+    .units = NUM_TARGETS,
+    .setup = sim_count_setup,
+    .read = sim_count_read,
+    .pause = sim_count_pause,
+    .resume = sim_count_resume,
+    .clear = sim_count_clear,
+    .set_pin = sim_count_set_pin,
+    .edges = sim_count_edges,
+};
+
+/*
+ * Store: a fixed table of typed entries, looked up by space and key. Like
+ * NVS, reading a key back as a different type finds nothing.
+ */
+typedef enum {
+    SIM_FREE = 0,
+    SIM_U8,
+    SIM_U16,
+    SIM_U32,
+    SIM_STR,
+    SIM_BLOB,
+} sim_type_t;
+
+typedef struct {
+    uint8_t space;              /* handle of the space, 0 = free */
+    uint8_t type;               /* sim_type_t */
+    uint8_t length;
+    char key[SIM_STORE_NAME];
+    uint8_t value[SIM_STORE_VALUE];
+} sim_entry_t;
+
+static char simSpace[SIM_STORE_SPACES][SIM_STORE_NAME];
+static sim_entry_t simStore[SIM_STORE_ENTRIES];
+
+void backend_sim_store_reset(void) {
+    memset(simSpace, 0, sizeof(simSpace));
+    memset(simStore, 0, sizeof(simStore));
+}
+
+static esp_err_t sim_store_init(void) {
+    return ESP_OK;
+}
+
+static esp_err_t sim_store_open(const char *space, backend_store_handle_t *handle) {
+    if (strlen(space) >= SIM_STORE_NAME) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (uint8_t i = 0; i < SIM_STORE_SPACES; i++) {
+        if (simSpace[i][0] == '\0') {
+            strcpy(simSpace[i], space);
+        }
+        if (strcmp(simSpace[i], space) == 0) {
+            *handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+static void sim_store_close(backend_store_handle_t handle) {
+}
+
+static sim_entry_t *sim_store_find(backend_store_handle_t handle, const char *key) {
+    for (uint16_t i = 0; i < SIM_STORE_ENTRIES; i++) {
+        if (simStore[i].space == handle && strcmp(simStore[i].key, key) == 0) {
+            return &simStore[i];
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t sim_store_get(backend_store_handle_t handle, const char *key, sim_type_t type, void *value, size_t *length) {
+    sim_entry_t *entry = sim_store_find(handle, key);
+    if (entry == NULL || entry->type != type) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (length != NULL) {
+        /* strings and blobs: NULL asks for the size, too small a buffer is an error */
+        if (value != NULL && *length < entry->length) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        *length = entry->length;
+        if (value == NULL) {
+            return ESP_OK;
+        }
+    }
+    memcpy(value, entry->value, entry->length);
+    return ESP_OK;
+}
+
+static esp_err_t sim_store_set(backend_store_handle_t handle, const char *key, sim_type_t type, const void *value, size_t length) {
+    if (strlen(key) >= SIM_STORE_NAME || length > SIM_STORE_VALUE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    sim_entry_t *entry = sim_store_find(handle, key);
+    for (uint16_t i = 0; entry == NULL && i < SIM_STORE_ENTRIES; i++) {
+        if (simStore[i].space == 0) {
+            entry = &simStore[i];
+        }
+    }
+    if (entry == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    entry->space = handle;
+    entry->type = type;
+    entry->length = length;
+    strcpy(entry->key, key);
+    memcpy(entry->value, value, length);
+    return ESP_OK;
+}
+
+static esp_err_t sim_store_get_u8(backend_store_handle_t handle, const char *key, uint8_t *value) {
+    return sim_store_get(handle, key, SIM_U8, value, NULL);
+}
+
+static esp_err_t sim_store_get_u16(backend_store_handle_t handle, const char *key, uint16_t *value) {
+    return sim_store_get(handle, key, SIM_U16, value, NULL);
+}
+
+static esp_err_t sim_store_get_u32(backend_store_handle_t handle, const char *key, uint32_t *value) {
+    return sim_store_get(handle, key, SIM_U32, value, NULL);
+}
+
+static esp_err_t sim_store_get_str(backend_store_handle_t handle, const char *key, char *value, size_t *length) {
+    return sim_store_get(handle, key, SIM_STR, value, length);
+}
+
+static esp_err_t sim_store_get_blob(backend_store_handle_t handle, const char *key, void *value, size_t *length) {
+    return sim_store_get(handle, key, SIM_BLOB, value, length);
+}
+
+static esp_err_t sim_store_set_u8(backend_store_handle_t handle, const char *key, uint8_t value) {
+    return sim_store_set(handle, key, SIM_U8, &value, sizeof(value));
+}
+
+static esp_err_t sim_store_set_u16(backend_store_handle_t handle, const char *key, uint16_t value) {
+    return sim_store_set(handle, key, SIM_U16, &value, sizeof(value));
+}
+
+static esp_err_t sim_store_set_u32(backend_store_handle_t handle, const char *key, uint32_t value) {
+    return sim_store_set(handle, key, SIM_U32, &value, sizeof(value));
+}
+
+static esp_err_t sim_store_set_str(backend_store_handle_t handle, const char *key, const char *value) {
+    /* stored with the terminator, as NVS does */
+    return sim_store_set(handle, key, SIM_STR, value, strlen(value) + 1);
+}
+
+static esp_err_t sim_store_set_blob(backend_store_handle_t handle, const char *key, const void *value, size_t length) {
+    return sim_store_set(handle, key, SIM_BLOB, value, length);
+}
+
+static esp_err_t sim_store_erase(backend_store_handle_t handle, const char *key) {
+    sim_entry_t *entry = sim_store_find(handle, key);
+    if (entry == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    memset(entry, 0, sizeof(sim_entry_t));
+    return ESP_OK;
+}
+
+static esp_err_t sim_store_commit(backend_store_handle_t handle) {
+    return ESP_OK;
+}
+
+static const backend_store_t simStoreOps = {
+    .init = sim_store_init,
+    .open = sim_store_open,
+    .close = sim_store_close,
+    .get_u8 = sim_store_get_u8,
+    .get_u16 = sim_store_get_u16,
+    .get_u32 = sim_store_get_u32,
+    .get_str = sim_store_get_str,
+    .get_blob = sim_store_get_blob,
+    .set_u8 = sim_store_set_u8,
+    .set_u16 = sim_store_set_u16,
+    .set_u32 = sim_store_set_u32,
+    .set_str = sim_store_set_str,
+    .set_blob = sim_store_set_blob,
+    .erase = sim_store_erase,
+    .commit = sim_store_commit,
+};
+
+const backend_t backendSim = {
+    .name = "simulated",
+    .pwm = &simPwmOps,
+    .count = &simCountOps,
+    .store = &simStoreOps,
+};
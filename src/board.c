@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <string.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <driver/gpio.h>
+#include "board.h"
+#include "backend.h"
+
+static const char* TAG = "Board";
+
+#if CONFIG_IDF_TARGET_ESP32S3
+static const board_t boardBuiltin = {
+    .version = BOARD_VERSION,
+    .channels = 6,
+    .ch = {
+        { .pwmPin = 4,  .tachPin = 10, .ppr = 2, .invert = 0 },
+        { .pwmPin = 5,  .tachPin = 11, .ppr = 2, .invert = 0 },
+        { .pwmPin = 6,  .tachPin = 12, .ppr = 2, .invert = 0 },
+        { .pwmPin = 7,  .tachPin = 13, .ppr = 2, .invert = 0 },
+        { .pwmPin = 15, .tachPin = 14, .ppr = 2, .invert = 0 },
+        { .pwmPin = 16, .tachPin = 17, .ppr = 2, .invert = 0 },
+    },
+};
+#else
+static const board_t boardBuiltin = {
+    .version = BOARD_VERSION,
+    .channels = 6,
+    .ch = {
+        { .pwmPin = 26, .tachPin = 25, .ppr = 2, .invert = 0 },
+        { .pwmPin = 18, .tachPin = 32, .ppr = 2, .invert = 0 },
+        { .pwmPin = 23, .tachPin = 4,  .ppr = 2, .invert = 0 },
+        { .pwmPin = 5,  .tachPin = 0,  .ppr = 2, .invert = 0 },
+        { .pwmPin = 33, .tachPin = 2,  .ppr = 2, .invert = 0 },
+        { .pwmPin = 22, .tachPin = 21, .ppr = 2, .invert = 0 },
+    },
+};
+#endif
+
+/* pins wired to the SPI flash and PSRAM, driving these would take the chip down */
+#if CONFIG_IDF_TARGET_ESP32S3
+#if CONFIG_SPIRAM_MODE_OCT || CONFIG_ESPTOOLPY_OCT_FLASH
+#define BOARD_RESERVED_PINS (0x7FULL << 26 | 0x1FULL << 33)
+#else
+#define BOARD_RESERVED_PINS (0x7FULL << 26)
+#endif
+#else
+#if CONFIG_SPIRAM || CONFIG_ESP32_SPIRAM_SUPPORT
+#define BOARD_RESERVED_PINS (0x3FULL << 6 | 1ULL << 16 | 1ULL << 17)
+#else
+#define BOARD_RESERVED_PINS (0x3FULL << 6)
+#endif
+#endif
+
+board_t board;
+/* the layout in use came from NVS */
+static bool boardStored;
+
+esp_err_t board_validate(const board_t *layout) {
+    if (layout->version != BOARD_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (layout->channels == 0 || layout->channels > NUM_TARGETS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint64_t used = 0;
+    for (uint8_t i = 0; i < layout->channels; i++) {
+        const boardChannel_t *ch = &layout->ch[i];
+        if (ch->pwmPin >= GPIO_NUM_MAX || ch->tachPin >= GPIO_NUM_MAX || ch->ppr == 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        /* input only pins can't drive a fan, no pin may be wired twice or belong to the flash */
+        if (!GPIO_IS_VALID_OUTPUT_GPIO(ch->pwmPin) || !GPIO_IS_VALID_GPIO(ch->tachPin)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        uint64_t pins = (1ULL << ch->pwmPin) | (1ULL << ch->tachPin);
+        if (ch->pwmPin == ch->tachPin || (used & pins) || (pins & BOARD_RESERVED_PINS)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        used |= pins;
+    }
+    return ESP_OK;
+}
+
+esp_err_t loadBoard(void) {
+    backend_store_handle_t my_handle;
+    board_t layout;
+
+    memcpy(&board, &boardBuiltin, sizeof(board_t));
+    boardStored = false;
+    esp_err_t err = storeBackend->open("board", &my_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    size_t size = sizeof(layout);
+    err = storeBackend->get_blob(my_handle, "layout", &layout, &size);
+    storeBackend->close(my_handle);
+    if (err == ESP_ERR_NOT_FOUND) {
+        ESP_LOGI(TAG, "Using the built in layout, %d channels", board.channels);
+        return ESP_OK;
+    } else if (err != ESP_OK) {
+        return err;
+    }
+    if (size != sizeof(layout) || board_validate(&layout) != ESP_OK) {
+        ESP_LOGW(TAG, "Ignoring invalid layout in NVS");
+        return ESP_OK;
+    }
+    memcpy(&board, &layout, sizeof(board_t));
+    boardStored = true;
+    ESP_LOGI(TAG, "Loaded layout from NVS, %d channels", board.channels);
+    return ESP_OK;
+}
+
+esp_err_t board_use_builtin(void) {
+    if (!boardStored) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* let go of whatever the stored layout already routed, the built in one may reuse the peripherals */
+    for (uint8_t i = 0; i < board.channels; i++) {
+        gpio_reset_pin(board.ch[i].pwmPin);
+        gpio_reset_pin(board.ch[i].tachPin);
+    }
+    memcpy(&board, &boardBuiltin, sizeof(board_t));
+    boardStored = false;
+    ESP_LOGW(TAG, "Reverted to the built in layout, %d channels", board.channels);
+    return ESP_OK;
+}
+
+esp_err_t saveBoard(const board_t *layout) {
+    backend_store_handle_t my_handle;
+
+    esp_err_t err = board_validate(layout);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = storeBackend->open("board", &my_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = storeBackend->set_blob(my_handle, "layout", layout, sizeof(board_t));
+    if (err == ESP_OK) {
+        err = storeBackend->commit(my_handle);
+    }
+    storeBackend->close(my_handle);
+    return err;
+}
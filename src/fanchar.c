@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "fanchar.h"
+#include "fanconfig.h"
+#include "target.h"
+#include "pwm.h"
+#include "board.h"
+
+static const char* TAG = "FanChar";
+
+#define FAN_CHAR_POLL_MS        100
+/* the RPM has to hold within FAN_CHAR_STABLE_PERMILLE for this many polls */
+#define FAN_CHAR_STABLE_POLLS   20
+#define FAN_CHAR_STABLE_PERMILLE 30
+#define FAN_CHAR_SETTLE_POLLS   150
+#define FAN_CHAR_MIN_STEP       4
+
+static volatile uint8_t charState[NUM_TARGETS];
+
+uint32_t fanchar_rpm(const fanChar_t *character, fanDuty_t duty) {
+    for (uint8_t i = 1; i < FAN_CHAR_POINTS; i++) {
+        int32_t hi = FAN_DUTY_FROM_U8(fanchar_point_duty(i));
+        if (duty <= hi) {
+            int32_t lo = FAN_DUTY_FROM_U8(fanchar_point_duty(i - 1));
+            int32_t from = character->rpm[i - 1], to = character->rpm[i];
+            return from + (int64_t)(to - from) * (duty - lo) / (hi - lo);
+        }
+    }
+    return character->rpm[FAN_CHAR_POINTS - 1];
+}
+
+fanDuty_t fanchar_duty(const fanChar_t *character, uint32_t rpm) {
+    if (rpm == 0) {
+        return 0;
+    }
+    for (uint8_t i = 1; i < FAN_CHAR_POINTS; i++) {
+        if (character->rpm[i] >= rpm) {
+            uint32_t lo = FAN_DUTY_FROM_U8(fanchar_point_duty(i - 1)), hi = FAN_DUTY_FROM_U8(fanchar_point_duty(i));
+            uint32_t from = character->rpm[i - 1], to = character->rpm[i];
+            if (rpm <= from || to == from) {
+                return lo;
+            }
+            return lo + (uint64_t)(hi - lo) * (rpm - from) / (to - from);
+        }
+    }
+    return FAN_DUTY_MAX;
+}
+
+fanDuty_t fanchar_min_duty(const fanChar_t *character, fanDuty_t configured) {
+    if (!character->valid) {
+        return configured;
+    }
+    uint16_t measured = character->minDuty + FAN_CHAR_MIN_MARGIN;
+    if (measured > 255) {
+        measured = 255;
+    }
+    measured = FAN_DUTY_FROM_U8(measured);
+    return measured > configured ? measured : configured;
+}
+
+fanCharState_t fanchar_state(uint8_t channel) {
+    return channel < NUM_TARGETS ? charState[channel] : FAN_CHAR_IDLE;
+}
+
+static uint32_t fanchar_read_rpm(uint8_t channel) {
+    target_t data;
+    target_get_data(channel, &data);
+    return data.rpm;
+}
+
+/* wait for the RPM to stop moving, optionally keeping every poll in trace */
+static uint32_t fanchar_settle(uint8_t channel, uint16_t *trace, uint8_t *traced) {
+    uint32_t prev = fanchar_read_rpm(channel);
+    uint8_t stable = 0;
+    for (uint8_t poll = 0; poll < FAN_CHAR_SETTLE_POLLS; poll++) {
+        vTaskDelay(pdMS_TO_TICKS(FAN_CHAR_POLL_MS));
+        uint32_t rpm = fanchar_read_rpm(channel);
+        if (trace) {
+            trace[poll] = rpm > UINT16_MAX ? UINT16_MAX : rpm;
+            *traced = poll + 1;
+        }
+        uint32_t diff = rpm > prev ? rpm - prev : prev - rpm;
+        prev = rpm;
+        if (diff * 1000 <= rpm * FAN_CHAR_STABLE_PERMILLE) {
+            if (++stable >= FAN_CHAR_STABLE_POLLS) {
+                break;
+            }
+        } else {
+            stable = 0;
+        }
+    }
+    return prev;
+}
+
+static esp_err_t fanchar_step(uint8_t channel, uint8_t duty, uint32_t *rpm) {
+    esp_err_t err = pwm_set_duty_immediate(channel, FAN_DUTY_FROM_U8(duty));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Channel %d: setting duty %d failed: %s", channel, duty, esp_err_to_name(err));
+        return err;
+    }
+    *rpm = fanchar_settle(channel, NULL, NULL);
+    ESP_LOGI(TAG, "Channel %d duty %d: %d RPM", channel, duty, *rpm);
+    return ESP_OK;
+}
+
+static esp_err_t fanchar_sweep(uint8_t channel, fanChar_t *result) {
+    uint16_t trace[FAN_CHAR_SETTLE_POLLS];
+    uint8_t traced = 0;
+    uint32_t rpm;
+    esp_err_t err;
+
+    memset(result, 0, sizeof(fanChar_t));
+    /* from rest to full duty, timing the run up */
+    if ((err = fanchar_step(channel, 0, &rpm)) != ESP_OK) {
+        return err;
+    }
+    if ((err = pwm_set_duty_immediate(channel, FAN_DUTY_MAX)) != ESP_OK) {
+        return err;
+    }
+    uint32_t full = fanchar_settle(channel, trace, &traced);
+    if (full == 0) {
+        ESP_LOGW(TAG, "Channel %d fan did not start", channel);
+        return ESP_ERR_NOT_FOUND;
+    }
+    for (uint8_t i = 0; i < traced; i++) {
+        if (trace[i] * 10 >= full * 9) {
+            result->spinupMs = (i + 1) * FAN_CHAR_POLL_MS;
+            break;
+        }
+    }
+    result->rpm[FAN_CHAR_POINTS - 1] = full > UINT16_MAX ? UINT16_MAX : full;
+
+    /* down through the points until it stops, the rest would only read 0 */
+    uint8_t lowest = 255;
+    for (int8_t i = FAN_CHAR_POINTS - 2; i > 0; i--) {
+        if ((err = fanchar_step(channel, fanchar_point_duty(i), &rpm)) != ESP_OK) {
+            return err;
+        }
+        result->rpm[i] = rpm > UINT16_MAX ? UINT16_MAX : rpm;
+        if (rpm == 0) {
+            /* get it turning again at the lowest duty that held */
+            if ((err = fanchar_step(channel, 255, &rpm)) != ESP_OK || (err = fanchar_step(channel, lowest, &rpm)) != ESP_OK) {
+                return err;
+            }
+            break;
+        }
+        lowest = fanchar_point_duty(i);
+    }
+    /* then on down in small steps to where it stops */
+    result->minDuty = lowest;
+    while (result->minDuty >= FAN_CHAR_MIN_STEP) {
+        uint8_t duty = result->minDuty - FAN_CHAR_MIN_STEP;
+        if ((err = fanchar_step(channel, duty, &rpm)) != ESP_OK) {
+            return err;
+        }
+        if (rpm == 0) {
+            break;
+        }
+        result->minDuty = duty;
+    }
+    result->valid = 1;
+    return ESP_OK;
+}
+
+static void vTaskFanChar(void *pvParameters) {
+    uint8_t channel = (uint8_t)(uintptr_t)pvParameters;
+    fanChar_t result;
+
+    ESP_LOGI(TAG, "Characterising channel %d", channel);
+    target_hold(channel, true);
+    esp_err_t err = fanchar_sweep(channel, &result);
+    /* put back whatever the control loop wants now, it takes over again from here */
+    target_t data;
+    target_get_data(channel, &data);
+    esp_err_t restored = pwm_set_duty_immediate(channel, data.duty);
+    target_hold(channel, false);
+    if (restored != ESP_OK) {
+        ESP_LOGE(TAG, "Channel %d: restoring duty failed: %s", channel, esp_err_to_name(restored));
+        if (err == ESP_OK) {
+            err = restored;
+        }
+    }
+
+    if (err == ESP_OK && xSemaphoreTake(configMutex, portMAX_DELAY) == pdTRUE) {
+        memcpy(&channelConfig[channel].character, &result, sizeof(fanChar_t));
+        xSemaphoreGive(configMutex);
+        err = saveChannelConfig(channel);
+    }
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Channel %d: min duty %d, spin-up %d ms, %d RPM at full duty", channel,
+                 result.minDuty, result.spinupMs, result.rpm[FAN_CHAR_POINTS - 1]);
+        charState[channel] = FAN_CHAR_DONE;
+    } else {
+        ESP_LOGE(TAG, "Characterising channel %d failed: %s", channel, esp_err_to_name(err));
+        charState[channel] = FAN_CHAR_FAILED;
+    }
+    vTaskDelete(NULL);
+}
+
+esp_err_t fanchar_start(uint8_t channel) {
+    if (channel >= board.channels) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (charState[channel] == FAN_CHAR_RUNNING) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    charState[channel] = FAN_CHAR_RUNNING;
+    if (xTaskCreate(vTaskFanChar, "FanChar", 3072, (void *)(uintptr_t)channel, 4, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create characterisation task");
+        charState[channel] = FAN_CHAR_IDLE;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
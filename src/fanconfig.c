@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -6,25 +7,32 @@
 #include <esp_err.h>
 #include <esp_log.h>
 #include "esp_system.h"
-#include "nvs_flash.h"
 #include "fanconfig.h"
+#include "board.h"
+#include "backend.h"
 
 static const char* TAG = "Config";
 
 esp_err_t setTZ(const char* tz);
 
-esp_err_t StartConfig(void) {
-    nvs_handle_t fanConfigHandle;
-    /* Initialize NVS partition */
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        /* NVS partition was truncated
-         * and needs to be erased */
-        ESP_ERROR_CHECK(nvs_flash_erase());
-
-        /* Retry nvs_flash_init */
-        ESP_ERROR_CHECK(nvs_flash_init());
+/* the curve compiler expects points in ascending temperature order */
+static void sortCurve(channelConfig_t *config) {
+    for (uint8_t i = 1; i < config->curvePoints; i++) {
+        fanCurvePoint_t point = config->curve[i];
+        int8_t j = i - 1;
+        while (j >= 0 && config->curve[j].temp > point.temp) {
+            config->curve[j + 1] = config->curve[j];
+            j--;
+        }
+        config->curve[j + 1] = point;
     }
+}
+
+esp_err_t StartConfig(void) {
+    backend_store_handle_t fanConfigHandle;
+    /* the store was brought up by StartBackend */
+    esp_err_t ret;
+    ESP_ERROR_CHECK(loadBoard());
     configMutex = xSemaphoreCreateMutex();
     if (configMutex == NULL) {
         ESP_LOGE(TAG, "Failed to create config mutex");
@@ -37,68 +45,68 @@ esp_err_t StartConfig(void) {
         ESP_LOGE(TAG, "Failed to take config mutex");
         return ESP_FAIL;
     }
-    ret = nvs_open("fanconfig", NVS_READWRITE, &fanConfigHandle);
+    ret = storeBackend->open("fanconfig", &fanConfigHandle);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Error opening fanconfig: %d", ret);
         xSemaphoreGive(configMutex);
         return ret;
     }
     size_t tzSize = sizeof(deviceConfig.tz);
-    if (nvs_get_str(fanConfigHandle, "timezone", deviceConfig.tz, &tzSize) == ESP_OK) {
+    if (storeBackend->get_str(fanConfigHandle, "timezone", deviceConfig.tz, &tzSize) == ESP_OK) {
         ESP_ERROR_CHECK(setTZ(deviceConfig.tz));
     } else {
         ESP_LOGI(TAG, "No timezone set - Setting to Asia/Singapore");
         ESP_ERROR_CHECK(setTZ("Asia/Singapore"));
-        ESP_ERROR_CHECK(nvs_set_str(fanConfigHandle, "timezone", "Asia/Singapore"));
+        ESP_ERROR_CHECK(storeBackend->set_str(fanConfigHandle, "timezone", "Asia/Singapore"));
         snprintf(deviceConfig.tz, sizeof(deviceConfig.tz), "Asia/Singapore");
     }
     tzSize = sizeof(deviceConfig.username);
-    if (nvs_get_str(fanConfigHandle, "username", deviceConfig.username, &tzSize) == ESP_OK) {
+    if (storeBackend->get_str(fanConfigHandle, "username", deviceConfig.username, &tzSize) == ESP_OK) {
         ESP_LOGI(TAG, "Username: %s", deviceConfig.username);
     } else {
         ESP_LOGI(TAG, "No username set - Defaulting to admin");
-        ESP_ERROR_CHECK(nvs_set_str(fanConfigHandle, "username", "admin"));
+        ESP_ERROR_CHECK(storeBackend->set_str(fanConfigHandle, "username", "admin"));
         snprintf(deviceConfig.username, sizeof(deviceConfig.username), "admin");
     }
     tzSize = sizeof(deviceConfig.password);
-    if (nvs_get_str(fanConfigHandle, "password", deviceConfig.password, &tzSize) == ESP_OK) {
+    if (storeBackend->get_str(fanConfigHandle, "password", deviceConfig.password, &tzSize) == ESP_OK) {
         ESP_LOGI(TAG, "Password Retrieved from nvs");
     } else {
         ESP_LOGI(TAG, "No password set - Defaulting to password");
-        ESP_ERROR_CHECK(nvs_set_str(fanConfigHandle, "password", "password"));
+        ESP_ERROR_CHECK(storeBackend->set_str(fanConfigHandle, "password", "password"));
         snprintf(deviceConfig.password, sizeof(deviceConfig.password), "password");
     }
     tzSize = sizeof(deviceConfig.agenttoken);
-    if (nvs_get_str(fanConfigHandle, "agenttoken", deviceConfig.agenttoken, &tzSize) == ESP_OK) {
+    if (storeBackend->get_str(fanConfigHandle, "agenttoken", deviceConfig.agenttoken, &tzSize) == ESP_OK) {
         ESP_LOGI(TAG, "Agent Token Retrieved from nvs");
     } else {
         ESP_LOGI(TAG, "No agent token set - Defaulting to agenttoken");
-        ESP_ERROR_CHECK(nvs_set_str(fanConfigHandle, "agenttoken", "12345678"));
+        ESP_ERROR_CHECK(storeBackend->set_str(fanConfigHandle, "agenttoken", "12345678"));
         snprintf(deviceConfig.agenttoken, sizeof(deviceConfig.agenttoken), "12345678");
     }
 
-    nvs_close(fanConfigHandle);
+    storeBackend->close(fanConfigHandle);
     xSemaphoreGive(configMutex);
     return ESP_OK;
 }
 
 esp_err_t saveTZ(char *tz) {
-    nvs_handle_t fanConfigHandle;
+    backend_store_handle_t fanConfigHandle;
     if (xSemaphoreTake(configMutex, portMAX_DELAY) != pdTRUE) {
         ESP_LOGE(TAG, "Failed to take config mutex");
         return ESP_FAIL;
     }
-    ESP_ERROR_CHECK(nvs_open("fanconfig", NVS_READWRITE, &fanConfigHandle));
+    ESP_ERROR_CHECK(storeBackend->open("fanconfig", &fanConfigHandle));
     setTZ(tz);
-    ESP_ERROR_CHECK(nvs_set_str(fanConfigHandle, "timezone", tz));
+    ESP_ERROR_CHECK(storeBackend->set_str(fanConfigHandle, "timezone", tz));
     snprintf(deviceConfig.tz, sizeof(deviceConfig.tz), tz);
-    nvs_close(fanConfigHandle);
+    storeBackend->close(fanConfigHandle);
     xSemaphoreGive(configMutex);
     return ESP_OK;
 }
 
 esp_err_t loadChannelConfig(uint8_t channel) {
-    nvs_handle_t my_handle;
+    backend_store_handle_t my_handle;
     esp_err_t err;
     char key[15];
 
@@ -116,15 +124,15 @@ esp_err_t loadChannelConfig(uint8_t channel) {
     ESP_LOGD(TAG, "Loading config for channel %d", channel);
 
     sprintf(key, "device-%d", channel);
-    err = nvs_open(key, NVS_READWRITE, &my_handle);
+    err = storeBackend->open(key, &my_handle);
     if (err != ESP_OK) {
         xSemaphoreGive(configMutex);
         return err;
     }
 
     uint8_t val;
-    err = nvs_get_u8(my_handle, "enabled", &val);
-    if (err == ESP_ERR_NVS_NOT_FOUND ) {
+    err = storeBackend->get_u8(my_handle, "enabled", &val);
+    if (err == ESP_ERR_NOT_FOUND ) {
         channelConfig[channel].enabled = true;
     } else if (err != ESP_OK) {
         xSemaphoreGive(configMutex);
@@ -132,38 +140,139 @@ esp_err_t loadChannelConfig(uint8_t channel) {
     } else {
         channelConfig[channel].enabled = val > 0 ? true : false;
     }
+    if (channel >= board.channels) {
+        /* nothing wired to it on this board */
+        channelConfig[channel].enabled = false;
+    }
 
-    err = nvs_get_u32(my_handle, "lowTemp", &channelConfig[channel].lowTemp);
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
+    err = storeBackend->get_u32(my_handle, "lowTemp", &channelConfig[channel].lowTemp);
+    if (err == ESP_ERR_NOT_FOUND) {
         channelConfig[channel].lowTemp = DEF_LOW_TEMP;
     } else if (err != ESP_OK) {
         xSemaphoreGive(configMutex);
         return err;
     } 
 
-    err = nvs_get_u32(my_handle, "highTemp", &channelConfig[channel].highTemp);
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
+    err = storeBackend->get_u32(my_handle, "highTemp", &channelConfig[channel].highTemp);
+    if (err == ESP_ERR_NOT_FOUND) {
         channelConfig[channel].highTemp = DEF_HIGH_TEMP;
     } else if (err != ESP_OK) {
         xSemaphoreGive(configMutex);
         return err;
     } 
 
-    err = nvs_get_u8(my_handle, "minDuty", &channelConfig[channel].minDuty);
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
+    err = storeBackend->get_u8(my_handle, "minDuty", &channelConfig[channel].minDuty);
+    if (err == ESP_ERR_NOT_FOUND) {
         channelConfig[channel].minDuty = DEF_LOW_DUTY;
     } else if (err != ESP_OK) {
         xSemaphoreGive(configMutex);
         return err;
     }
 
-    nvs_close(my_handle);
+    size_t curveSize = sizeof(channelConfig[channel].curve);
+    err = storeBackend->get_blob(my_handle, "curve", channelConfig[channel].curve, &curveSize);
+    if (err == ESP_ERR_NOT_FOUND) {
+        channelConfig[channel].curvePoints = 0;
+    } else if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    } else {
+        channelConfig[channel].curvePoints = curveSize / sizeof(fanCurvePoint_t);
+        sortCurve(&channelConfig[channel]);
+    }
+
+    err = storeBackend->get_u8(my_handle, "mode", &channelConfig[channel].mode);
+    if (err == ESP_ERR_NOT_FOUND) {
+        channelConfig[channel].mode = CHANNEL_MODE_CURVE;
+    } else if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->get_u32(my_handle, "maxRPM", &channelConfig[channel].maxRPM);
+    if (err == ESP_ERR_NOT_FOUND) {
+        channelConfig[channel].maxRPM = DEF_MAX_RPM;
+    } else if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->get_u32(my_handle, "failsafe", &channelConfig[channel].failsafeTimeout);
+    if (err == ESP_ERR_NOT_FOUND) {
+        channelConfig[channel].failsafeTimeout = DEF_FAILSAFE_TIMEOUT;
+    } else if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->get_u16(my_handle, "hysteresis", &channelConfig[channel].limits.hysteresis);
+    if (err == ESP_ERR_NOT_FOUND) {
+        channelConfig[channel].limits.hysteresis = DEF_HYSTERESIS;
+    } else if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->get_u8(my_handle, "minStep", &channelConfig[channel].limits.minStep);
+    if (err == ESP_ERR_NOT_FOUND) {
+        channelConfig[channel].limits.minStep = DEF_MIN_STEP;
+    } else if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->get_u16(my_handle, "slewRate", &channelConfig[channel].limits.slewRate);
+    if (err == ESP_ERR_NOT_FOUND) {
+        channelConfig[channel].limits.slewRate = DEF_SLEW_RATE;
+    } else if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->get_u16(my_handle, "fadeRate", &channelConfig[channel].fadeRate);
+    if (err == ESP_ERR_NOT_FOUND) {
+        channelConfig[channel].fadeRate = DEF_FADE_RATE;
+    } else if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->get_u16(my_handle, "kickMs", &channelConfig[channel].kickMs);
+    if (err == ESP_ERR_NOT_FOUND) {
+        channelConfig[channel].kickMs = DEF_KICK_MS;
+    } else if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    size_t pidSize = sizeof(channelConfig[channel].pid);
+    err = storeBackend->get_blob(my_handle, "pid", &channelConfig[channel].pid, &pidSize);
+    if (err == ESP_ERR_NOT_FOUND || (err == ESP_OK && pidSize != sizeof(fanPidGains_t))) {
+        channelConfig[channel].pid.kp = DEF_PID_KP;
+        channelConfig[channel].pid.ki = DEF_PID_KI;
+        channelConfig[channel].pid.kd = DEF_PID_KD;
+    } else if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    size_t charSize = sizeof(channelConfig[channel].character);
+    err = storeBackend->get_blob(my_handle, "char", &channelConfig[channel].character, &charSize);
+    if (err == ESP_ERR_NOT_FOUND || (err == ESP_OK && charSize != sizeof(fanChar_t))) {
+        memset(&channelConfig[channel].character, 0, sizeof(fanChar_t));
+    } else if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    storeBackend->close(my_handle);
     xSemaphoreGive(configMutex);
+    target_send_config(channel);
     return ESP_OK;
 }
 
 esp_err_t saveChannelConfig(uint8_t channel) {
-    nvs_handle_t my_handle;
+    backend_store_handle_t my_handle;
     esp_err_t err;
     char key[15];
 
@@ -180,44 +289,127 @@ esp_err_t saveChannelConfig(uint8_t channel) {
     }
 
     sprintf(key, "device-%d", channel);
-    err = nvs_open(key, NVS_READWRITE, &my_handle);
+    err = storeBackend->open(key, &my_handle);
     if (err != ESP_OK) {
         xSemaphoreGive(configMutex);
         return err;
     }
 
-    err = nvs_set_u8(my_handle, "enabled", channelConfig[channel].enabled);
+    err = storeBackend->set_u8(my_handle, "enabled", channelConfig[channel].enabled);
     if (err != ESP_OK) {
         xSemaphoreGive(configMutex);
         return err;
     }
 
-    err = nvs_set_u32(my_handle, "lowTemp", channelConfig[channel].lowTemp);
+    err = storeBackend->set_u32(my_handle, "lowTemp", channelConfig[channel].lowTemp);
     if (err != ESP_OK) {
         xSemaphoreGive(configMutex);
         return err;
     }
 
-    err = nvs_set_u32(my_handle, "highTemp", channelConfig[channel].highTemp);
+    err = storeBackend->set_u32(my_handle, "highTemp", channelConfig[channel].highTemp);
     if (err != ESP_OK) {
         xSemaphoreGive(configMutex);        
         return err;
     }
-    err = nvs_set_u8(my_handle, "minDuty", channelConfig[channel].minDuty);
+    err = storeBackend->set_u8(my_handle, "minDuty", channelConfig[channel].minDuty);
     if (err != ESP_OK) { 
         xSemaphoreGive(configMutex);        
         return err;
     }
 
-    err = nvs_commit(my_handle);
+    err = storeBackend->set_u8(my_handle, "mode", channelConfig[channel].mode);
+    if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->set_u32(my_handle, "maxRPM", channelConfig[channel].maxRPM);
+    if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->set_u32(my_handle, "failsafe", channelConfig[channel].failsafeTimeout);
+    if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->set_u16(my_handle, "hysteresis", channelConfig[channel].limits.hysteresis);
+    if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->set_u8(my_handle, "minStep", channelConfig[channel].limits.minStep);
+    if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->set_u16(my_handle, "slewRate", channelConfig[channel].limits.slewRate);
+    if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->set_u16(my_handle, "fadeRate", channelConfig[channel].fadeRate);
+    if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->set_u16(my_handle, "kickMs", channelConfig[channel].kickMs);
+    if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->set_blob(my_handle, "pid", &channelConfig[channel].pid, sizeof(fanPidGains_t));
+    if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    if (channelConfig[channel].character.valid) {
+        err = storeBackend->set_blob(my_handle, "char", &channelConfig[channel].character, sizeof(fanChar_t));
+    } else {
+        err = storeBackend->erase(my_handle, "char");
+        if (err == ESP_ERR_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    }
+    if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    if (channelConfig[channel].curvePoints > 0) {
+        sortCurve(&channelConfig[channel]);
+        err = storeBackend->set_blob(my_handle, "curve", channelConfig[channel].curve, channelConfig[channel].curvePoints * sizeof(fanCurvePoint_t));
+    } else {
+        err = storeBackend->erase(my_handle, "curve");
+        if (err == ESP_ERR_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    }
+    if (err != ESP_OK) {
+        xSemaphoreGive(configMutex);
+        return err;
+    }
+
+    err = storeBackend->commit(my_handle);
     if (err != ESP_OK) {
         xSemaphoreGive(configMutex);        
         return err;
     }
 
-    nvs_close(my_handle);
+    storeBackend->close(my_handle);
     
     xSemaphoreGive(configMutex);
 
+    target_send_config(channel);
+
     return ESP_OK;
 }
\ No newline at end of file
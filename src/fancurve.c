@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <string.h>
+#include "fancurve.h"
+
+fanDuty_t fanCurveTable[NUM_TARGETS][FAN_CURVE_LUT_SIZE];
+
+void fancurve_compile(uint8_t channel, const fanCurvePoint_t *points, uint8_t numPoints, uint32_t lowTemp, uint32_t highTemp, fanDuty_t minDuty) {
+    fanCurvePoint_t def[2];
+    if (channel >= NUM_TARGETS) {
+        return;
+    }
+    if (numPoints == 0 || points == NULL) {
+        def[0].temp = lowTemp > FAN_CURVE_MAX_TEMP ? FAN_CURVE_MAX_TEMP : lowTemp;
+        def[0].duty = 0;
+        def[1].temp = highTemp > FAN_CURVE_MAX_TEMP ? FAN_CURVE_MAX_TEMP : highTemp;
+        def[1].duty = 255;
+        points = def;
+        numPoints = 2;
+    }
+    if (numPoints > FAN_CURVE_MAX_POINTS) {
+        numPoints = FAN_CURVE_MAX_POINTS;
+    }
+    fanDuty_t *table = fanCurveTable[channel];
+    uint32_t first = points[0].temp * FAN_CURVE_STEPS_PER_DEGREE;
+    uint8_t seg = 0;
+    for (uint32_t i = 0; i < FAN_CURVE_LUT_SIZE; i++) {
+        if (i < first) {
+            table[i] = 0;
+            continue;
+        }
+        /* points are sorted by temperature, so walk the segments forward */
+        while (seg + 1 < numPoints && i >= points[seg + 1].temp * FAN_CURVE_STEPS_PER_DEGREE) {
+            seg++;
+        }
+        uint32_t duty;
+        if (seg + 1 >= numPoints) {
+            duty = FAN_DUTY_FROM_U8(points[numPoints - 1].duty);
+        } else {
+            int32_t t0 = points[seg].temp * FAN_CURVE_STEPS_PER_DEGREE;
+            int32_t t1 = points[seg + 1].temp * FAN_CURVE_STEPS_PER_DEGREE;
+            /* interpolate in Q16 so the steps between points are not lost to 8 bits */
+            int32_t d0 = FAN_DUTY_FROM_U8(points[seg].duty);
+            int32_t d1 = FAN_DUTY_FROM_U8(points[seg + 1].duty);
+            duty = d0 + (d1 - d0) * ((int32_t)i - t0) / (t1 - t0);
+        }
+        if (duty < minDuty) {
+            duty = minDuty;
+        }
+        table[i] = duty;
+    }
+}
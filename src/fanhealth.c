@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include "fanhealth.h"
+
+void fanhealth_reset(fanHealthState_t *state, fanDuty_t duty, int64_t now) {
+    state->status = FAN_HEALTH_OK;
+    state->duty = duty;
+    state->dutyAt = now;
+    state->spinning = false;
+    state->zeroSamples = 0;
+    state->ratio = 0;
+}
+
+static bool fanhealth_set(fanHealthState_t *state, uint8_t status) {
+    if (state->status == status) {
+        return false;
+    }
+    state->status = status;
+    return true;
+}
+
+bool fanhealth_duty(fanHealthState_t *state, fanDuty_t duty, int64_t now) {
+    if (duty == state->duty) {
+        return false;
+    }
+    bool changed = false;
+    if (duty == 0) {
+        /* stopped on purpose, the next start is a fresh spin-up */
+        state->spinning = false;
+        changed = fanhealth_set(state, FAN_HEALTH_OK);
+    }
+    state->duty = duty;
+    state->dutyAt = now;
+    state->zeroSamples = 0;
+    return changed;
+}
+
+bool fanhealth_sample(fanHealthState_t *state, uint32_t rpm, uint32_t expected, int64_t now) {
+    if (state->duty < FAN_HEALTH_MIN_DUTY || expected == 0) {
+        state->zeroSamples = 0;
+        if (rpm > 0) {
+            state->spinning = true;
+            /* a failed kick is reported at any duty, so it clears at any duty */
+            if (state->status == FAN_HEALTH_SPINUP_FAILED) {
+                return fanhealth_set(state, FAN_HEALTH_OK);
+            }
+        }
+        return false;
+    }
+    bool settled = now - state->dutyAt >= FAN_HEALTH_SETTLE_US;
+    if (rpm == 0) {
+        if (state->spinning) {
+            if (state->zeroSamples < FAN_HEALTH_STALL_SAMPLES) {
+                state->zeroSamples++;
+            }
+            if (state->zeroSamples >= FAN_HEALTH_STALL_SAMPLES) {
+                return fanhealth_set(state, FAN_HEALTH_STALLED);
+            }
+        } else if (settled) {
+            return fanhealth_set(state, FAN_HEALTH_SPINUP_FAILED);
+        }
+        return false;
+    }
+    state->zeroSamples = 0;
+    state->spinning = true;
+    bool changed = false;
+    if (state->status == FAN_HEALTH_STALLED || state->status == FAN_HEALTH_SPINUP_FAILED) {
+        changed = fanhealth_set(state, FAN_HEALTH_OK);
+    }
+    if (!settled) {
+        return changed;
+    }
+    uint32_t sample = (uint64_t)rpm * 1000 / expected;
+    if (sample > 2000) {
+        sample = 2000;
+    }
+    if (state->ratio == 0) {
+        state->ratio = sample;
+    } else {
+        state->ratio += ((int32_t)sample - (int32_t)state->ratio) >> FAN_HEALTH_RATIO_SHIFT;
+    }
+    if (state->status == FAN_HEALTH_OK && state->ratio < FAN_HEALTH_DEGRADED_BELOW) {
+        changed = fanhealth_set(state, FAN_HEALTH_DEGRADED);
+    } else if (state->status == FAN_HEALTH_DEGRADED && state->ratio >= FAN_HEALTH_RECOVERED_ABOVE) {
+        changed = fanhealth_set(state, FAN_HEALTH_OK);
+    }
+    return changed;
+}
+
+bool fanhealth_kick_failed(fanHealthState_t *state) {
+    if (state->spinning) {
+        return false;
+    }
+    return fanhealth_set(state, FAN_HEALTH_SPINUP_FAILED);
+}
+
+const char *fanhealth_name(uint8_t status) {
+    switch (status) {
+        case FAN_HEALTH_OK:
+            return "ok";
+        case FAN_HEALTH_DEGRADED:
+            return "degraded";
+        case FAN_HEALTH_STALLED:
+            return "stalled";
+        case FAN_HEALTH_SPINUP_FAILED:
+            return "spinup-failed";
+    }
+    return "unknown";
+}
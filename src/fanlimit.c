@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include "fanlimit.h"
+
+fanDuty_t fanlimit_apply(fanLimitState_t *state, const fanLimits_t *limits, fanDuty_t current, fanDuty_t wanted, float temp, int64_t now) {
+    /* a ramp already in progress keeps going without re-checking the deadband */
+    bool ramping = state->pending;
+    state->pending = false;
+    if (wanted == current) {
+        return current;
+    }
+    bool endpoint = (wanted == 0 || wanted == FAN_DUTY_MAX);
+    if (!endpoint && !ramping) {
+        float moved = temp - state->appliedTemp;
+        if (moved < 0) {
+            moved = -moved;
+        }
+        if (moved * 10 < limits->hysteresis) {
+            return current;
+        }
+        fanDuty_t step = wanted > current ? wanted - current : current - wanted;
+        if (step < FAN_DUTY_FROM_U8(limits->minStep)) {
+            return current;
+        }
+    }
+    fanDuty_t duty = wanted;
+    if (limits->slewRate > 0 && state->appliedAt > 0) {
+        int64_t maxStep = (int64_t)limits->slewRate * FAN_DUTY_FROM_U8(1) * (now - state->appliedAt) / 1000000;
+        if (maxStep < 1) {
+            /* too soon to move even one step */
+            state->pending = true;
+            return current;
+        }
+        if (wanted > current && wanted - current > maxStep) {
+            duty = current + maxStep;
+            state->pending = true;
+        } else if (wanted < current && current - wanted > maxStep) {
+            duty = current - maxStep;
+            state->pending = true;
+        }
+    }
+    state->appliedTemp = temp;
+    state->appliedAt = now;
+    return duty;
+}
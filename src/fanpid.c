@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include "fanpid.h"
+
+void fanpid_reset(fanPidState_t *state) {
+    state->integral = 0;
+    state->prevError = 0;
+    state->primed = false;
+}
+
+fanDuty_t fanpid_step(fanPidState_t *state, const fanPidGains_t *gains, uint32_t setpoint, uint32_t measured,
+                      uint32_t maxRPM, fanDuty_t feedForward, float dt, fanDuty_t minDuty) {
+    if (maxRPM == 0 || dt <= 0) {
+        return feedForward;
+    }
+    float error = ((float)setpoint - (float)measured) / (float)maxRPM;
+    float derivative = state->primed ? (error - state->prevError) / dt : 0;
+    state->prevError = error;
+    state->primed = true;
+
+    float integral = state->integral + error * dt;
+    float out = feedForward + (float)FAN_DUTY_MAX * (gains->kp * error + gains->ki * integral + gains->kd * derivative);
+
+    /* conditional integration: only keep the new integral if it doesn't push further into saturation */
+    if (out > FAN_DUTY_MAX) {
+        out = FAN_DUTY_MAX;
+        if (error < 0) {
+            state->integral = integral;
+        }
+    } else if (out < minDuty) {
+        out = minDuty;
+        if (error > 0) {
+            state->integral = integral;
+        }
+    } else {
+        state->integral = integral;
+    }
+    return (fanDuty_t)(out + 0.5f);
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include "latency.h"
+
+static latency_hist_t histograms[LATENCY_STAGE_MAX];
+static portMUX_TYPE latencyLock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *stageNames[LATENCY_STAGE_MAX] = {
+    "queue",
+    "calc",
+    "apply",
+    "total",
+    "tachwake",
+    "tachgate",
+};
+
+static inline uint8_t latency_bucket(uint32_t us) {
+    if (us < LATENCY_SUB_BUCKETS) {
+        return us;
+    }
+    uint8_t exp = 31 - __builtin_clz(us);
+    uint32_t bucket = ((exp - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) + ((us >> (exp - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+uint32_t latency_bucket_limit(uint8_t bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+    uint8_t exp = (bucket >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+    uint32_t sub = bucket & (LATENCY_SUB_BUCKETS - 1);
+    return (1UL << exp) + ((sub + 1) << (exp - LATENCY_SUB_BITS)) - 1;
+}
+
+void latency_record(latency_stage_t stage, uint32_t us) {
+    if (stage >= LATENCY_STAGE_MAX) {
+        return;
+    }
+    uint8_t bucket = latency_bucket(us);
+    portENTER_CRITICAL(&latencyLock);
+    latency_hist_t *hist = &histograms[stage];
+    hist->count++;
+    hist->sum += us;
+    if (us > hist->max) {
+        hist->max = us;
+    }
+    hist->buckets[bucket]++;
+    portEXIT_CRITICAL(&latencyLock);
+}
+
+void latency_get(latency_stage_t stage, latency_hist_t *hist) {
+    if (stage >= LATENCY_STAGE_MAX) {
+        memset(hist, 0, sizeof(latency_hist_t));
+        return;
+    }
+    portENTER_CRITICAL(&latencyLock);
+    memcpy(hist, &histograms[stage], sizeof(latency_hist_t));
+    portEXIT_CRITICAL(&latencyLock);
+}
+
+void latency_reset(void) {
+    portENTER_CRITICAL(&latencyLock);
+    memset(histograms, 0, sizeof(histograms));
+    portEXIT_CRITICAL(&latencyLock);
+}
+
+const char *latency_stage_name(latency_stage_t stage) {
+    return stage < LATENCY_STAGE_MAX ? stageNames[stage] : "unknown";
+}
+
+uint32_t latency_percentile(const latency_hist_t *hist, uint16_t permille) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    uint64_t wanted = ((uint64_t)hist->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= wanted && i < LATENCY_BUCKETS - 1) {
+            uint32_t limit = latency_bucket_limit(i);
+            return limit < hist->max ? limit : hist->max;
+        }
+    }
+    return hist->max;
+}
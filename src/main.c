@@ -14,6 +14,8 @@
 #include "network.h"
 #include "target.h"
 #include "tacho.h"
+#include "backend.h"
+#include "board.h"
 
 static const char* TAG = "Main";
 
@@ -54,7 +56,9 @@ void app_main() {
     /* Initialize the event loop */
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     ESP_ERROR_CHECK(esp_event_handler_register(TIME_EVENTS, ESP_EVENT_ANY_ID, &event_callback, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(TARGET_EVENTS, ESP_EVENT_ANY_ID, &event_callback, NULL));
 
+    ESP_ERROR_CHECK(StartBackend());
     ESP_ERROR_CHECK(StartConfig());
 
     ESP_ERROR_CHECK(StartWIFI());
@@ -66,15 +70,28 @@ void app_main() {
     }
     ESP_LOGD(TAG, "Network started");
 
-    ESP_ERROR_CHECK(StartPWM());
-    ESP_LOGD(TAG, "PWM started");
+    /*
+     * A stored layout that can't be driven would otherwise abort on every
+     * boot. Both ends are brought up before the target task, so either one
+     * failing moves the pair to the built in layout. Tach readings sent
+     * before the target task exists wait in its mailbox.
+     */
+    err = StartPWM();
+    if (err == ESP_OK) {
+        err = StartTacho();
+    }
+    if (err != ESP_OK && board_use_builtin() == ESP_OK) {
+        err = StartPWM();
+        if (err == ESP_OK) {
+            err = StartTacho();
+        }
+    }
+    ESP_ERROR_CHECK(err);
+    ESP_LOGD(TAG, "PWM and Tacho started");
 
     ESP_ERROR_CHECK(StartTarget());
     ESP_LOGD(TAG, "Target started");
 
-    ESP_ERROR_CHECK(StartTacho());
-    ESP_LOGD(TAG, "Tacho started");
-
     ESP_ERROR_CHECK(StartOTATask());
     ESP_LOGD(TAG, "OTA Background Task Started");
 
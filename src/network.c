@@ -7,6 +7,7 @@
 #include <esp_chip_info.h>
 #include <esp_random.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <string.h>
 #include <fcntl.h>
 #include <cJSON.h>
@@ -16,12 +17,17 @@
 #include <lwip/sockets.h>
 #include <lwip/netdb.h>
 #include <pb_encode.h>
-#include <pb_decode.h>
 #include "fanctrlevents.h"
 #include "fanconfig.h"
 #include "network.h"
 #include "pwm.h"
 #include "target.h"
+#include "tacho.h"
+#include "fanhealth.h"
+#include "board.h"
+#include "latency.h"
+#include "rxring.h"
+#include "sockframe.h"
 #include "espmsg.pb.h"
 
 #define PORT 1234
@@ -36,9 +42,8 @@ typedef struct {
     int socket;
     struct sockaddr_storage source_addr;
     sock_state_t state;
-    uint32_t pck_len;
-    uint32_t pck_buf_len;
-    uint32_t pck_buf[512];
+    int64_t pck_time;           /* esp_timer time the current packet started arriving */
+    rxring_t rx;
     char challenge[8];
 } sock_info_t;
 
@@ -240,7 +245,7 @@ static esp_err_t pwm_post_handler(httpd_req_t *req)
     buf[total_len] = '\0';
 
     cJSON *root = cJSON_Parse(buf);
-        if (cJSON_HasObjectItem(root, "duty") == false) {
+        if (cJSON_HasObjectItem(root, "duty") == false && cJSON_HasObjectItem(root, "permille") == false) {
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Missing Duty Value");
         return ESP_FAIL;
     }
@@ -250,8 +255,14 @@ static esp_err_t pwm_post_handler(httpd_req_t *req)
     }
 
     int channel = cJSON_GetObjectItem(root, "channel")->valueint;
-    int duty = cJSON_GetObjectItem(root, "duty")->valueint;
-    ESP_LOGI(TAG, "PWM control: Channel:%d Duty: %d", channel, duty);
+    fanDuty_t duty;
+    if (cJSON_HasObjectItem(root, "permille")) {
+        int permille = cJSON_GetObjectItem(root, "permille")->valueint;
+        duty = FAN_DUTY_FROM_PERMILLE(permille < 0 ? 0 : permille > 1000 ? 1000 : permille);
+    } else {
+        duty = fan_duty_from_float(cJSON_GetObjectItem(root, "duty")->valuedouble);
+    }
+    ESP_LOGI(TAG, "PWM control: Channel:%d Duty: %d/65535", channel, duty);
     cJSON_Delete(root);
     esp_err_t err = target_send_duty(channel, duty);
     if (err) {
@@ -271,7 +282,9 @@ static esp_err_t pwm_get_handler(httpd_req_t *req)
 
     httpd_resp_set_type(req, "application/json");
     cJSON *root = cJSON_CreateObject();
-    for (size_t index = 0; index < LEDC_TEST_CH_NUM; index++) {
+    target_t data[NUM_TARGETS];
+    target_get_all(data);
+    for (size_t index = 0; index < board.channels; index++) {
         cJSON *pwm = cJSON_CreateObject();
         if (pwm == NULL) {
             goto end;
@@ -279,10 +292,10 @@ static esp_err_t pwm_get_handler(httpd_req_t *req)
         char channel[10];
         sprintf(channel, "%d", index);
         cJSON_AddItemToObject(root, channel, pwm);
-        target_t data;
-        ESP_ERROR_CHECK(target_get_data(index, &data));
-        cJSON *value = cJSON_CreateNumber(data.duty);
+        cJSON *value = cJSON_CreateNumber(FAN_DUTY_TO_U8(data[index].duty));
         cJSON_AddItemToObject(pwm, "duty", value);
+        cJSON_AddNumberToObject(pwm, "permille", FAN_DUTY_TO_PERMILLE(data[index].duty));
+        cJSON_AddNumberToObject(pwm, "effective", FAN_DUTY_TO_PERMILLE(pwm_get_duty(index)));
     }
 
     const char *pwm_json = cJSON_Print(root);
@@ -352,7 +365,9 @@ static esp_err_t temp_get_handler(httpd_req_t *req)
 
     httpd_resp_set_type(req, "application/json");
     cJSON *root = cJSON_CreateObject();
-    for (size_t index = 0; index < LEDC_TEST_CH_NUM; index++) {
+    target_t data[NUM_TARGETS];
+    target_get_all(data);
+    for (size_t index = 0; index < board.channels; index++) {
         cJSON *pwm = cJSON_CreateObject();
         if (pwm == NULL) {
             goto end;
@@ -360,9 +375,7 @@ static esp_err_t temp_get_handler(httpd_req_t *req)
         char channel[10];
         sprintf(channel, "%d", index);
         cJSON_AddItemToObject(root, channel, pwm);
-        target_t data;
-        ESP_ERROR_CHECK(target_get_data(index, &data));
-        cJSON *value = cJSON_CreateNumber(data.temp);
+        cJSON *value = cJSON_CreateNumber(data[index].temp);
         cJSON_AddItemToObject(pwm, "temp", value);
     }
 
@@ -383,7 +396,9 @@ static esp_err_t data_get_handler(httpd_req_t *req)
 
     httpd_resp_set_type(req, "application/json");
     cJSON *root = cJSON_CreateObject();
-    for (size_t index = 0; index < LEDC_TEST_CH_NUM; index++) {
+    target_t data[NUM_TARGETS];
+    target_get_all(data);
+    for (size_t index = 0; index < board.channels; index++) {
         cJSON *pwm = cJSON_CreateObject();
         if (pwm == NULL) {
             goto end;
@@ -391,18 +406,28 @@ static esp_err_t data_get_handler(httpd_req_t *req)
         char channel[10];
         sprintf(channel, "%d", index);
         cJSON_AddItemToObject(root, channel, pwm);
-        target_t data;
-        ESP_ERROR_CHECK(target_get_data(index, &data));
-        cJSON *temp = cJSON_CreateNumber(data.temp);
+        cJSON *temp = cJSON_CreateNumber(data[index].temp);
         cJSON_AddItemToObject(pwm, "temp", temp);
-        cJSON *duty = cJSON_CreateNumber(data.duty);
+        cJSON *duty = cJSON_CreateNumber(FAN_DUTY_TO_U8(data[index].duty));
         cJSON_AddItemToObject(pwm, "duty", duty);
-        cJSON *rpm = cJSON_CreateNumber(data.rpm);
+        cJSON_AddNumberToObject(pwm, "permille", FAN_DUTY_TO_PERMILLE(data[index].duty));
+        cJSON_AddNumberToObject(pwm, "effective", FAN_DUTY_TO_PERMILLE(pwm_get_duty(index)));
+        cJSON *rpm = cJSON_CreateNumber(data[index].rpm);
         cJSON_AddItemToObject(pwm, "rpm", rpm);
-        cJSON *load = cJSON_CreateNumber(data.load);
+        cJSON *load = cJSON_CreateNumber(data[index].load);
         cJSON_AddItemToObject(pwm, "load", load);
-        cJSON *lastupdate = cJSON_CreateNumber(data.lastUpdate);
+        cJSON *lastupdate = cJSON_CreateNumber(data[index].lastUpdate);
         cJSON_AddItemToObject(pwm, "lastupdate", lastupdate);
+        cJSON *targetrpm = cJSON_CreateNumber(data[index].targetRPM);
+        cJSON_AddItemToObject(pwm, "targetrpm", targetrpm);
+        cJSON *stale = cJSON_CreateBool(data[index].stale);
+        cJSON_AddItemToObject(pwm, "stale", stale);
+        cJSON_AddStringToObject(pwm, "health", fanhealth_name(data[index].health));
+        tacho_stats_t tach;
+        tacho_get_stats(index, &tach);
+        cJSON_AddNumberToObject(pwm, "tachwindow", tach.window);
+        cJSON_AddNumberToObject(pwm, "tachrate", tach.rate / 1000.0);
+        cJSON_AddNumberToObject(pwm, "rpmerror", tach.error);
     }
 
     const char *pwm_json = cJSON_Print(root);
@@ -428,7 +453,7 @@ static esp_err_t config_get_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
     cJSON *root = cJSON_CreateObject();
-    cJSON *channels = cJSON_CreateNumber(NUM_TARGETS);
+    cJSON *channels = cJSON_CreateNumber(board.channels);
     cJSON_AddItemToObject(root, "channels", channels);
 
     cJSON *tz = cJSON_CreateString(deviceConfig.tz);
@@ -440,7 +465,7 @@ static esp_err_t config_get_handler(httpd_req_t *req)
     cJSON *password = cJSON_CreateBool(strlen(deviceConfig.password) > 0 ? true : false);
     cJSON_AddItemToObject(root, "passwordset", password);
 
-    for (size_t index = 0; index < NUM_TARGETS; index++) {
+    for (size_t index = 0; index < board.channels; index++) {
         cJSON *pwm = cJSON_CreateObject();
         if (pwm == NULL) {
             goto end;
@@ -456,6 +481,44 @@ static esp_err_t config_get_handler(httpd_req_t *req)
         cJSON_AddItemToObject(pwm, "highTemp", highTemp);
         cJSON *minDuty = cJSON_CreateNumber(channelConfig[index].minDuty);
         cJSON_AddItemToObject(pwm, "minDuty", minDuty);
+        cJSON *curve = cJSON_CreateArray();
+        for (uint8_t i = 0; i < channelConfig[index].curvePoints; i++) {
+            cJSON *point = cJSON_CreateObject();
+            cJSON_AddNumberToObject(point, "temp", channelConfig[index].curve[i].temp);
+            cJSON_AddNumberToObject(point, "duty", channelConfig[index].curve[i].duty);
+            cJSON_AddItemToArray(curve, point);
+        }
+        cJSON_AddItemToObject(pwm, "curve", curve);
+        cJSON_AddStringToObject(pwm, "mode", channelConfig[index].mode == CHANNEL_MODE_PID ? "pid" : "curve");
+        cJSON_AddNumberToObject(pwm, "maxRPM", channelConfig[index].maxRPM);
+        cJSON_AddNumberToObject(pwm, "failsafeTimeout", channelConfig[index].failsafeTimeout);
+        cJSON_AddNumberToObject(pwm, "hysteresis", channelConfig[index].limits.hysteresis / 10.0);
+        cJSON_AddNumberToObject(pwm, "minStep", channelConfig[index].limits.minStep);
+        cJSON_AddNumberToObject(pwm, "slewRate", channelConfig[index].limits.slewRate);
+        cJSON_AddNumberToObject(pwm, "fadeRate", channelConfig[index].fadeRate);
+        cJSON_AddNumberToObject(pwm, "kickMs", channelConfig[index].kickMs);
+        cJSON *pid = cJSON_CreateObject();
+        cJSON_AddNumberToObject(pid, "kp", channelConfig[index].pid.kp);
+        cJSON_AddNumberToObject(pid, "ki", channelConfig[index].pid.ki);
+        cJSON_AddNumberToObject(pid, "kd", channelConfig[index].pid.kd);
+        cJSON_AddItemToObject(pwm, "pid", pid);
+        cJSON *character = cJSON_CreateObject();
+        static const char *charStates[] = {"idle", "running", "done", "failed"};
+        cJSON_AddStringToObject(character, "state", charStates[fanchar_state(index)]);
+        cJSON_AddBoolToObject(character, "valid", channelConfig[index].character.valid);
+        if (channelConfig[index].character.valid) {
+            cJSON_AddNumberToObject(character, "minDuty", channelConfig[index].character.minDuty);
+            cJSON_AddNumberToObject(character, "spinupMs", channelConfig[index].character.spinupMs);
+            cJSON *points = cJSON_CreateArray();
+            for (uint8_t i = 0; i < FAN_CHAR_POINTS; i++) {
+                cJSON *point = cJSON_CreateObject();
+                cJSON_AddNumberToObject(point, "duty", fanchar_point_duty(i));
+                cJSON_AddNumberToObject(point, "rpm", channelConfig[index].character.rpm[i]);
+                cJSON_AddItemToArray(points, point);
+            }
+            cJSON_AddItemToObject(character, "curve", points);
+        }
+        cJSON_AddItemToObject(pwm, "characterisation", character);
     }
 
     const char *pwm_json = cJSON_Print(root);
@@ -481,6 +544,20 @@ static esp_err_t info_get_handler(httpd_req_t *req)
     esp_chip_info(&chip_info);
     cJSON_AddStringToObject(root, "version", IDF_VER);
     cJSON_AddNumberToObject(root, "cores", chip_info.cores);
+    cJSON_AddNumberToObject(root, "freeheap", xPortGetFreeHeapSize());
+    cJSON_AddNumberToObject(root, "minfreeheap", xPortGetMinimumEverFreeHeapSize());
+    target_stats_t stats;
+    target_get_stats(&stats);
+    cJSON *target = cJSON_CreateObject();
+    cJSON_AddNumberToObject(target, "posted", stats.posted);
+    cJSON_AddNumberToObject(target, "coalesced", stats.coalesced);
+    cJSON_AddNumberToObject(target, "suppressed", stats.suppressed);
+    cJSON_AddNumberToObject(target, "wakeups", stats.wakeups);
+    cJSON_AddNumberToObject(target, "drained", stats.drained);
+    cJSON_AddNumberToObject(target, "applied", stats.applied);
+    cJSON_AddNumberToObject(target, "perwakeup", stats.wakeups ? (double)stats.drained / stats.wakeups : 0);
+    cJSON_AddNumberToObject(root, "uptime", esp_timer_get_time() / 1000000);
+    cJSON_AddItemToObject(root, "target", target);
     const char *sys_info = cJSON_Print(root);
     httpd_resp_sendstr(req, sys_info);
     free((void *)sys_info);
@@ -489,6 +566,232 @@ static esp_err_t info_get_handler(httpd_req_t *req)
 }
 
 
+/* handler to get the control latency histograms */
+static esp_err_t latency_get_handler(httpd_req_t *req)
+{
+    if (basic_auth_get_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    cJSON *root = cJSON_CreateObject();
+    for (int i = 0; i < LATENCY_STAGE_MAX; i++) {
+        latency_hist_t hist;
+        latency_get(i, &hist);
+        cJSON *stage = cJSON_CreateObject();
+        cJSON_AddItemToObject(root, latency_stage_name(i), stage);
+        cJSON_AddNumberToObject(stage, "count", hist.count);
+        cJSON_AddNumberToObject(stage, "mean", hist.count ? hist.sum / hist.count : 0);
+        cJSON_AddNumberToObject(stage, "p50", latency_percentile(&hist, 500));
+        cJSON_AddNumberToObject(stage, "p90", latency_percentile(&hist, 900));
+        cJSON_AddNumberToObject(stage, "p99", latency_percentile(&hist, 990));
+        cJSON_AddNumberToObject(stage, "max", hist.max);
+        /* only the populated buckets, as [upper bound us, count] */
+        cJSON *buckets = cJSON_CreateArray();
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            if (hist.buckets[b] == 0) {
+                continue;
+            }
+            cJSON *bucket = cJSON_CreateArray();
+            cJSON_AddItemToArray(bucket, cJSON_CreateNumber(latency_bucket_limit(b)));
+            cJSON_AddItemToArray(bucket, cJSON_CreateNumber(hist.buckets[b]));
+            cJSON_AddItemToArray(buckets, bucket);
+        }
+        cJSON_AddItemToObject(stage, "buckets", buckets);
+    }
+    const char *latency_json = cJSON_Print(root);
+    httpd_resp_sendstr(req, latency_json);
+    free((void *)latency_json);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+/* handler for the board layout in use */
+static esp_err_t board_get_handler(httpd_req_t *req)
+{
+    if (basic_auth_get_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "channels", board.channels);
+    cJSON *pins = cJSON_CreateArray();
+    for (uint8_t i = 0; i < board.channels; i++) {
+        cJSON *pin = cJSON_CreateObject();
+        cJSON_AddNumberToObject(pin, "pwm", board.ch[i].pwmPin);
+        cJSON_AddNumberToObject(pin, "tach", board.ch[i].tachPin);
+        cJSON_AddNumberToObject(pin, "ppr", board.ch[i].ppr);
+        cJSON_AddBoolToObject(pin, "invert", board.ch[i].invert);
+        cJSON_AddItemToArray(pins, pin);
+    }
+    cJSON_AddItemToObject(root, "pins", pins);
+    const char *board_json = cJSON_Print(root);
+    httpd_resp_sendstr(req, board_json);
+    free((void *)board_json);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+/* handler to store a new board layout, it takes effect at the next boot */
+static esp_err_t board_post_handler(httpd_req_t *req)
+{
+    if (basic_auth_get_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    int total_len = req->content_len;
+    int cur_len = 0;
+    char *buf = ((rest_server_context_t *)(req->user_ctx))->scratch;
+    int received = 0;
+    if (total_len >= SCRATCH_BUFSIZE) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "content too long");
+        return ESP_FAIL;
+    }
+    while (cur_len < total_len) {
+        received = httpd_req_recv(req, buf + cur_len, total_len);
+        if (received <= 0) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to post board layout");
+            return ESP_FAIL;
+        }
+        cur_len += received;
+    }
+    buf[total_len] = '\0';
+
+    cJSON *root = cJSON_Parse(buf);
+    cJSON *pins = cJSON_GetObjectItem(root, "pins");
+    if (root == NULL || !cJSON_IsArray(pins)) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing pins");
+        return ESP_FAIL;
+    }
+    board_t layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.version = BOARD_VERSION;
+    layout.channels = cJSON_GetArraySize(pins) > NUM_TARGETS ? 0 : cJSON_GetArraySize(pins);
+    for (uint8_t i = 0; i < layout.channels; i++) {
+        cJSON *pin = cJSON_GetArrayItem(pins, i);
+        cJSON *pwm = cJSON_GetObjectItem(pin, "pwm");
+        cJSON *tach = cJSON_GetObjectItem(pin, "tach");
+        cJSON *ppr = cJSON_GetObjectItem(pin, "ppr");
+        if (!cJSON_IsNumber(pwm) || !cJSON_IsNumber(tach) || pwm->valueint < 0 || pwm->valueint > UINT8_MAX
+            || tach->valueint < 0 || tach->valueint > UINT8_MAX
+            || (cJSON_IsNumber(ppr) && (ppr->valueint < 1 || ppr->valueint > UINT8_MAX))) {
+            layout.channels = 0;
+            break;
+        }
+        /* in range for the narrowing, board_validate checks the pins themselves */
+        layout.ch[i].pwmPin = pwm->valueint;
+        layout.ch[i].tachPin = tach->valueint;
+        layout.ch[i].ppr = cJSON_IsNumber(ppr) ? ppr->valueint : 2;
+        layout.ch[i].invert = cJSON_IsTrue(cJSON_GetObjectItem(pin, "invert"));
+    }
+    cJSON_Delete(root);
+    esp_err_t err = saveBoard(&layout);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid board layout");
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Saved a %d channel board layout, used from the next boot", layout.channels);
+    httpd_resp_sendstr(req, "OK");
+    return ESP_OK;
+}
+
+/* handler to start the characterisation sweep of a channel, results land in the config */
+static esp_err_t characterise_post_handler(httpd_req_t *req)
+{
+    if (basic_auth_get_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    int channel = -1;
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "channel", value, sizeof(value)) == ESP_OK) {
+            channel = atoi(value);
+        }
+    }
+    if (channel < 0 || channel >= board.channels) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid channel");
+        return ESP_FAIL;
+    }
+    esp_err_t err = fanchar_start(channel);
+    if (err == ESP_ERR_INVALID_STATE) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Already running");
+        return ESP_FAIL;
+    } else if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to start");
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Characterising channel %d", channel);
+    httpd_resp_sendstr(req, "OK");
+    return ESP_OK;
+}
+
+/* handler for the unfiltered tach readings of one channel */
+static esp_err_t tacho_raw_get_handler(httpd_req_t *req)
+{
+    if (basic_auth_get_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    int channel = 0;
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "channel", value, sizeof(value)) == ESP_OK) {
+            channel = atoi(value);
+        }
+    }
+    if (channel < 0 || channel >= board.channels) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid channel");
+        return ESP_FAIL;
+    }
+
+    tacho_sample_t samples[TACHO_RAW_SAMPLES];
+    uint8_t count;
+    tacho_get_raw(channel, samples, &count);
+    target_t data;
+    target_get_data(channel, &data);
+
+    httpd_resp_set_type(req, "application/json");
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "channel", channel);
+    cJSON_AddNumberToObject(root, "rpm", data.rpm);
+    cJSON *raw = cJSON_CreateArray();
+    for (uint8_t i = 0; i < count; i++) {
+        cJSON *sample = cJSON_CreateObject();
+        cJSON_AddNumberToObject(sample, "time", samples[i].time);
+        cJSON_AddNumberToObject(sample, "rpm", samples[i].rpm);
+        cJSON_AddItemToArray(raw, sample);
+    }
+    cJSON_AddItemToObject(root, "raw", raw);
+    const char *raw_json = cJSON_Print(root);
+    httpd_resp_sendstr(req, raw_json);
+    free((void *)raw_json);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+/* every REST endpoint, the server is sized to hold exactly these */
+static const httpd_uri_t rest_uris[] = {
+    /* system info and config */
+    { .uri = "/api/v1/system/info", .method = HTTP_GET, .handler = info_get_handler },
+    { .uri = "/api/v1/system/config", .method = HTTP_GET, .handler = config_get_handler },
+    /* PWM and temperature values */
+    { .uri = "/api/v1/pwm", .method = HTTP_POST, .handler = pwm_post_handler },
+    { .uri = "/api/v1/pwm", .method = HTTP_GET, .handler = pwm_get_handler },
+    { .uri = "/api/v1/temp", .method = HTTP_POST, .handler = temp_post_handler },
+    { .uri = "/api/v1/temp", .method = HTTP_GET, .handler = temp_get_handler },
+    { .uri = "/api/v1/data", .method = HTTP_GET, .handler = data_get_handler },
+    { .uri = "/api/v1/system/latency", .method = HTTP_GET, .handler = latency_get_handler },
+    { .uri = "/api/v1/tacho/raw", .method = HTTP_GET, .handler = tacho_raw_get_handler },
+    { .uri = "/api/v1/system/characterise", .method = HTTP_POST, .handler = characterise_post_handler },
+    { .uri = "/api/v1/system/board", .method = HTTP_GET, .handler = board_get_handler },
+    { .uri = "/api/v1/system/board", .method = HTTP_POST, .handler = board_post_handler },
+};
+
 esp_err_t start_rest_server(const char *base_path)
 {
     REST_CHECK(base_path, "wrong base path", err);
@@ -499,72 +802,18 @@ esp_err_t start_rest_server(const char *base_path)
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
+    config.max_uri_handlers = sizeof(rest_uris) / sizeof(rest_uris[0]);
 
     ESP_LOGI(TAG, "Starting HTTP Server");
     REST_CHECK(httpd_start(&server, &config) == ESP_OK, "Start server failed", err_start);
 
-    /* URI handler for fetching system info */
-    httpd_uri_t info_get_uri = {
-        .uri = "/api/v1/system/info",
-        .method = HTTP_GET,
-        .handler = info_get_handler,
-        .user_ctx = rest_context
-    };
-    httpd_register_uri_handler(server, &info_get_uri);
-
-    /* URI handler for fetching system config */
-    httpd_uri_t config_get_uri = {
-        .uri = "/api/v1/system/config",
-        .method = HTTP_GET,
-        .handler = config_get_handler,
-        .user_ctx = rest_context
-    };
-    httpd_register_uri_handler(server, &config_get_uri);
-
-
-
-    /* URI handler to Set PWM Value */
-    httpd_uri_t pwm_post_uri = {
-        .uri = "/api/v1/pwm",
-        .method = HTTP_POST,
-        .handler = pwm_post_handler,
-        .user_ctx = rest_context
-    };
-    httpd_register_uri_handler(server, &pwm_post_uri);
-
-    /* URI handler to Set PWM Value */
-    httpd_uri_t pwm_get_uri = {
-        .uri = "/api/v1/pwm",
-        .method = HTTP_GET,
-        .handler = pwm_get_handler,
-        .user_ctx = rest_context
-    };
-    httpd_register_uri_handler(server, &pwm_get_uri);
-
-    /* URI handler to Set Temp Value */
-    httpd_uri_t temp_post_uri = {
-        .uri = "/api/v1/temp",
-        .method = HTTP_POST,
-        .handler = temp_post_handler,
-        .user_ctx = rest_context
-    };
-    httpd_register_uri_handler(server, &temp_post_uri);
-
-    httpd_uri_t temp_get_uri  = {
-        .uri = "/api/v1/temp",
-        .method = HTTP_GET,
-        .handler = temp_get_handler,
-        .user_ctx = rest_context
-    };
-    httpd_register_uri_handler(server, &temp_get_uri);
-
-    httpd_uri_t data_get_uri = {
-        .uri = "/api/v1/data",
-        .method = HTTP_GET,
-        .handler = data_get_handler,
-        .user_ctx = rest_context
-    };
-    httpd_register_uri_handler(server, &data_get_uri);
+    for (size_t i = 0; i < sizeof(rest_uris) / sizeof(rest_uris[0]); i++) {
+        httpd_uri_t uri = rest_uris[i];
+        uri.user_ctx = rest_context;
+        if (httpd_register_uri_handler(server, &uri) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to register %s", uri.uri);
+        }
+    }
 
     // /* URI handler for getting web server files */
     // httpd_uri_t common_get_uri = {
@@ -648,14 +897,14 @@ esp_err_t send_response(sock_info_t *client, espmsg_EspReq_Msg *request) {
         response.operation = espmsg_EspMsgType_OpGetConfig;
         response.which_op = espmsg_EspResult_Config_tag;
         response.id = request->id;
-        response.op.Config.channels = NUM_TARGETS;
+        response.op.Config.channels = board.channels;
         strncpy(response.op.Config.tz, deviceConfig.tz, sizeof(response.op.Config.tz));
         if (xSemaphoreTake(configMutex, portMAX_DELAY) != pdTRUE) {
             ESP_LOGE(TAG, "Failed to take config mutex");
             socket_close(client);
             return ESP_FAIL;
         }
-        for (int i = 0; i < NUM_TARGETS; i++ ) {
+        for (int i = 0; i < board.channels; i++ ) {
             response.op.Config.CfgConfig[i].enabled = channelConfig[i].enabled;
             response.op.Config.CfgConfig[i].lowTemp = channelConfig[i].lowTemp;
             response.op.Config.CfgConfig[i].highTemp = channelConfig[i].highTemp;
@@ -668,11 +917,33 @@ esp_err_t send_response(sock_info_t *client, espmsg_EspReq_Msg *request) {
         response.which_op = espmsg_EspResult_Status_tag;
         response.id = request->id;
         target_t data;
-        ESP_ERROR_CHECK(target_get_data(response.id, &data));
-        response.op.Status.duty = data.duty;
+        if (target_get_data(response.id, &data) != ESP_OK) {
+            ESP_LOGW(TAG, "Status: Invalid Channel %d", response.id);
+            return ESP_ERR_INVALID_ARG;
+        }
+        response.op.Status.duty = FAN_DUTY_TO_U8(data.duty);
+        response.op.Status.dutyQ16 = data.duty;
         response.op.Status.temp = data.temp;
         response.op.Status.rpm = data.rpm;
         response.op.Status.load = data.load;
+    } else if (request->operation == espmsg_EspMsgType_OPGetLatency) {
+        ESP_LOGI(TAG, "Sending Latency Response");
+        response.operation = espmsg_EspMsgType_OPGetLatency;
+        response.which_op = espmsg_EspResult_Latency_tag;
+        response.id = request->id;
+        response.op.Latency.stages_count = LATENCY_STAGE_MAX;
+        for (int i = 0; i < LATENCY_STAGE_MAX; i++) {
+            latency_hist_t hist;
+            espmsg_EspResult_LatencyStage *stage = &response.op.Latency.stages[i];
+            latency_get(i, &hist);
+            strlcpy(stage->name, latency_stage_name(i), sizeof(stage->name));
+            stage->count = hist.count;
+            stage->mean = hist.count ? hist.sum / hist.count : 0;
+            stage->p50 = latency_percentile(&hist, 500);
+            stage->p90 = latency_percentile(&hist, 900);
+            stage->p99 = latency_percentile(&hist, 990);
+            stage->max = hist.max;
+        }
     } else {
         ESP_LOGE(TAG, "Unhandled Response %d", request->operation);
         return ESP_OK;
@@ -697,15 +968,21 @@ esp_err_t send_response(sock_info_t *client, espmsg_EspReq_Msg *request) {
 
 esp_err_t process_perfpkt(sock_info_t *client, espmsg_EspReq_Msg *request) {
     ESP_LOGI(TAG, "Perf Packet: Channel: %d, Temp: %f, Load: %f", request->id, request->op.Perf.temp, request->op.Perf.load);
-    ESP_ERROR_CHECK(target_send_temp(request->id, request->op.Perf.temp));
-    ESP_ERROR_CHECK(target_send_load(request->id, request->op.Perf.load));
+    if (target_send_temp_stamped(request->id, request->op.Perf.temp, client->pck_time) != ESP_OK ||
+        target_send_load(request->id, request->op.Perf.load) != ESP_OK) {
+        ESP_LOGW(TAG, "Perf Packet: Invalid Channel %d or Temp %f", request->id, request->op.Perf.temp);
+        return ESP_ERR_INVALID_ARG;
+    }
     vTaskDelay(pdMS_TO_TICKS(1));
     return send_response(client, request);
 }
 
 esp_err_t process_dutypkt(sock_info_t *client, espmsg_EspReq_Msg *request) {
     ESP_LOGI(TAG, "Duty Packet: Channel: %d, Duty: %f", request->id, request->op.Duty.duty);
-    ESP_ERROR_CHECK(target_send_duty(request->id, request->op.Duty.duty));
+    if (target_send_duty_stamped(request->id, fan_duty_from_float(request->op.Duty.duty), client->pck_time) != ESP_OK) {
+        ESP_LOGW(TAG, "Duty Packet: Invalid Channel %d", request->id);
+        return ESP_ERR_INVALID_ARG;
+    }
     vTaskDelay(pdMS_TO_TICKS(1));
     return send_response(client, request);
 }
@@ -778,6 +1055,11 @@ esp_err_t process_request(sock_info_t *client, espmsg_EspReq_Msg *request) {
                 process_statuspkt(client, request);
                 return ESP_OK;
                 break;
+            case espmsg_EspMsgType_OPGetLatency:
+                if (check_auth(client) != ESP_OK) return ESP_FAIL;
+                send_response(client, request);
+                return ESP_OK;
+                break;
             case espmsg_EspMsgType_OpGetConfig:
                 //if (check_auth(client) != ESP_OK) return ESP_FAIL;
                 process_configpkt(client, request);
@@ -796,8 +1078,7 @@ esp_err_t socket_close(sock_info_t *client) {
         close(client->socket);
         client->socket = -1;
         client->state = 0;
-        client->pck_buf_len = 0;
-        client->pck_len = 0;
+        rxring_reset(&client->rx);
     }
     return ESP_OK;
 }
@@ -829,88 +1110,53 @@ int socket_send(sock_info_t *client, const char * data, const size_t len)
 
 
 esp_err_t sock_recv(sock_info_t *client) {
-    if (client->pck_len == 0) {
-        ESP_LOGV(TAG, "Pending Header");
-        char buf[4];
-        int len = recv(client->socket, &buf, sizeof(buf), MSG_PEEK);
-        ESP_LOGV(TAG, "Header: Peeked %d", len);
-        if (len >= sizeof(int32_t)) {
-            len = recv(client->socket, &buf, sizeof(buf), 0);
-            ESP_LOGV(TAG, "Header: Took %d", len);
-            if (len == 0) {
-                ESP_LOGI(TAG, "Get Header: Connection closed");
-                socket_close(client);
-                return ESP_OK;
-            } else if (len < 0) {
-                if (errno != EINPROGRESS && errno != EAGAIN && errno != EWOULDBLOCK) {
-                    ESP_LOGE(TAG, "Get Header: Error occurred during receiving: errno %d", errno);
-                    socket_close(client);
-                    return ESP_ERR_INVALID_STATE;
-                }
-                ESP_LOGE(TAG, "Get Header: Would Block %d", errno);
-                return ESP_OK;
-            } else {
-                ESP_LOG_BUFFER_HEX_LEVEL(TAG, buf, len, ESP_LOG_VERBOSE);
-                client->pck_len = ntohl(*((int32_t*)buf));
-                ESP_LOGV(TAG, "Header Said %d bytes data", client->pck_len);
-                /* make sure pck_len isn't bigger than our buffer */
-                if (client->pck_len > sizeof(client->pck_buf)) {
-                    ESP_LOGE(TAG, "Get Header: Packet too big");
-                    socket_close(client);
-                    return ESP_ERR_INVALID_SIZE;
-                }
-            }
-        } else if (len == 0) {
-            ESP_LOGE(TAG, "Header Peek: Connection closed");
+    size_t space;
+    uint8_t *at = rxring_write_ptr(&client->rx, &space);
+    bool idle = rxring_used(&client->rx) == 0;
+    int len = recv(client->socket, at, space, 0);
+    if (len == 0) {
+        ESP_LOGI(TAG, "Connection closed");
+        socket_close(client);
+        return ESP_OK;
+    } else if (len < 0) {
+        if (errno != EINPROGRESS && errno != EAGAIN && errno != EWOULDBLOCK) {
+            ESP_LOGE(TAG, "Error occurred during receiving: errno %d", errno);
             socket_close(client);
-            return ESP_OK;
-        } else if (len < 0) {
-            if (errno != EINPROGRESS && errno != EAGAIN && errno != EWOULDBLOCK) {
-                ESP_LOGE(TAG, "Header Peek: Error occurred during receiving: errno %d", errno);
-                socket_close(client);
-                return ESP_ERR_INVALID_STATE;
-            }
-            ESP_LOGE(TAG, "Header Peek: Would Block %d", errno);
-            return ESP_OK;
+            return ESP_ERR_INVALID_STATE;
         }
+        return ESP_OK;
+    }
+    int64_t now = esp_timer_get_time();
+    if (idle) {
+        client->pck_time = now;
     }
-    ESP_LOGV(TAG, "Client State Now: Want %d, Have %d", client->pck_len, client->pck_buf_len);
-    if (client->pck_len > 0) {
-        ESP_LOGV(TAG, "Pending Data Have: %d - Want additional: %d", client->pck_buf_len, client->pck_len - client->pck_buf_len);
-        int len = recv(client->socket, &client->pck_buf + client->pck_buf_len, client->pck_len - client->pck_buf_len, 0);
-        if (len == 0) {
-            ESP_LOGE(TAG, "Get Data: Connection closed");
+    rxring_produce(&client->rx, len);
+    ESP_LOGV(TAG, "Took %d bytes, %d buffered", len, rxring_used(&client->rx));
+
+    /* dispatch every complete frame before going back to select */
+    uint32_t pck_len;
+    rxframe_t frame;
+    while ((frame = rxring_frame(&client->rx, &pck_len)) == RX_FRAME_READY) {
+        espmsg_EspReq_Msg request = {};
+        if (!sock_decode(&client->rx, RX_FRAME_HEADER, pck_len, &request)) {
             socket_close(client);
+            return ESP_ERR_INVALID_ARG;
+        }
+        rxring_consume(&client->rx, RX_FRAME_HEADER + pck_len);
+        process_request(client, &request);
+        if (client->socket == -1) {
+            /* closed while handling the request */
             return ESP_OK;
-        } else if (len < 0) {
-            if (errno != EINPROGRESS && errno != EAGAIN && errno != EWOULDBLOCK) {
-                ESP_LOGE(TAG, "Get Data: Error occurred during receiving: errno %d", errno);
-                socket_close(client);
-                return ESP_ERR_INVALID_STATE;
-            }
-            return ESP_OK;
-        } else {
-            ESP_LOGV(TAG, "Took %d Data", len);
-            client->pck_buf_len += len;
-            if (client->pck_buf_len == client->pck_len) {
-                ESP_LOGV(TAG, "Got Full Packet");
-                espmsg_EspReq_Msg request = {};
-                pb_istream_t input = pb_istream_from_buffer((pb_byte_t*)&client->pck_buf, client->pck_buf_len);
-                if (!pb_decode(&input, espmsg_EspReq_Msg_fields, &request))
-                {
-                    ESP_LOGW(TAG, "Decoding failed: %s\n", PB_GET_ERROR(&input));
-                    socket_close(client);
-                    return ESP_ERR_INVALID_ARG;
-                }
-                process_request(client, &request);
-                client->pck_len = 0;
-                client->pck_buf_len = 0;
-                return ESP_OK;
-            } else {
-                ESP_LOGV(TAG, "Got Partial Packet");
-            }
         }
+        /* whatever follows arrived no later than this read */
+        client->pck_time = now;
+    }
+    if (frame == RX_FRAME_INVALID) {
+        ESP_LOGE(TAG, "Packet too big: %d", pck_len);
+        socket_close(client);
+        return ESP_ERR_INVALID_SIZE;
     }
+    ESP_LOGV(TAG, "%d bytes of a partial packet buffered", rxring_used(&client->rx));
     return ESP_OK;
 }
 
@@ -925,8 +1171,7 @@ void vTaskTCPServer(void* pvParameters) {
     for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; i++) {
         client_info[i].socket = -1;
         client_info[i].state = 0;
-        client_info[i].pck_buf_len = 0;
-        client_info[i].pck_len = 0;
+        rxring_reset(&client_info[i].rx);
     }
 
     struct sockaddr_in *dest_addr_ip4 = (struct sockaddr_in *)&dest_addr;
@@ -7,255 +7,410 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 #include <stdio.h>
-#include <math.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
-#include <driver/ledc.h>
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include "pwm.h"
+#include "board.h"
+#include "backend.h"
 
 static const char* TAG = "PWM";
 
-/*
- * About this example
- *
- * 1. Start with initializing LEDC module:
- *    a. Set the timer of LEDC first, this determines the frequency
- *       and resolution of PWM.
- *    b. Then set the LEDC channel you want to use,
- *       and bind with one of the timers.
- *
- * 2. You need first to install a default fade function,
- *    then you can use fade APIs.
- *
- * 3. You can also set a target duty directly without fading.
- *
- * 4. On ESP32, GPIO18/19/4/5 are used as the LEDC outputs:
- *              GPIO18/19 are from the high speed channel group
- *              GPIO4/5 are from the low speed channel group
- *
- *    On other targets, GPIO8/9/4/5 are used as the LEDC outputs,
- *    and they are all from the low speed channel group.
- *
- * 5. All the LEDC outputs change the duty repeatedly.
- *
- */
-#define LEDC_HS_TIMER          LEDC_TIMER_0
-#ifdef CONFIG_IDF_TARGET_ESP32
-#define LEDC_HS_MODE           LEDC_HIGH_SPEED_MODE
-#elif CONFIG_IDF_TARGET_ESP32S3
-#define LEDC_HS_MODE           LEDC_LOW_SPEED_MODE
+/* the profile is fixed at build time, the rest of the firmware only sees Q16 duty */
+#define PWM_FREQ_HZ CONFIG_FANCTRL_PWM_FREQ_HZ
+#define PWM_RESOLUTION_BITS CONFIG_FANCTRL_PWM_RESOLUTION_BITS
+#define PWM_DUTY_FULL ((1u << PWM_RESOLUTION_BITS) - 1)
+#if PWM_FREQ_HZ * (1ll << PWM_RESOLUTION_BITS) > 80000000
+#error "PWM frequency and resolution exceed the LEDC clock"
 #endif
-#define LEDC_HS_CH0_GPIO       (26)
-#define LEDC_HS_CH0_CHANNEL    LEDC_CHANNEL_0
-#define LEDC_HS_CH1_GPIO       (18)
-#define LEDC_HS_CH1_CHANNEL    LEDC_CHANNEL_1
-#define LEDC_HS_CH2_GPIO       (23)
-#define LEDC_HS_CH2_CHANNEL    LEDC_CHANNEL_2
-#define LEDC_HS_CH3_GPIO       (5)
-#define LEDC_HS_CH3_CHANNEL    LEDC_CHANNEL_3
-#define LEDC_HS_CH4_GPIO       (33)
-#define LEDC_HS_CH4_CHANNEL    LEDC_CHANNEL_4
-#define LEDC_HS_CH5_GPIO       (22)
-#define LEDC_HS_CH5_CHANNEL    LEDC_CHANNEL_6
 
+static inline uint32_t pwm_to_counts(fanDuty_t duty)
+{
+    return ((uint32_t)duty * PWM_DUTY_FULL + FAN_DUTY_MAX / 2) / FAN_DUTY_MAX;
+}
 
-    /*
-     * Prepare individual configuration
-     * for each channel of LED Controller
-     * by selecting:
-     * - controller's channel number
-     * - output duty cycle, set initially to 0
-     * - GPIO number where LED is connected to
-     * - speed mode, either high or low
-     * - timer servicing selected channel
-     *   Note: if different channels use one timer,
-     *         then frequency and bit_num of these channels
-     *         will be the same
-     */
-    ledc_channel_config_t ledc_channel[LEDC_TEST_CH_NUM] = {
-        {
-            .channel    = LEDC_HS_CH0_CHANNEL,
-            .duty       = 0,
-            .gpio_num   = LEDC_HS_CH0_GPIO,
-            .speed_mode = LEDC_HS_MODE,
-            .hpoint     = 0,
-            .timer_sel  = LEDC_HS_TIMER,
-            .flags.output_invert = 0
-        },
-        {
-            .channel    = LEDC_HS_CH1_CHANNEL,
-            .duty       = 0,
-            .gpio_num   = LEDC_HS_CH1_GPIO,
-            .speed_mode = LEDC_HS_MODE,
-            .hpoint     = 0,
-            .timer_sel  = LEDC_HS_TIMER,
-            .flags.output_invert = 0
-        },
-        {
-            .channel    = LEDC_HS_CH2_CHANNEL,
-            .duty       = 0,
-            .gpio_num   = LEDC_HS_CH2_GPIO,
-            .speed_mode = LEDC_HS_MODE,
-            .hpoint     = 0,
-            .timer_sel  = LEDC_HS_TIMER,
-            .flags.output_invert = 0
-        },
-        {
-            .channel    = LEDC_HS_CH3_CHANNEL,
-            .duty       = 0,
-            .gpio_num   = LEDC_HS_CH3_GPIO,
-            .speed_mode = LEDC_HS_MODE,
-            .hpoint     = 0,
-            .timer_sel  = LEDC_HS_TIMER,
-            .flags.output_invert = 0
-        },
-        {
-            .channel    = LEDC_HS_CH4_CHANNEL,
-            .duty       = 0,
-            .gpio_num   = LEDC_HS_CH4_GPIO,
-            .speed_mode = LEDC_HS_MODE,
-            .hpoint     = 0,
-            .timer_sel  = LEDC_HS_TIMER,
-            .flags.output_invert = 0
-        },
-        {
-            .channel    = LEDC_HS_CH5_CHANNEL,
-            .duty       = 0,
-            .gpio_num   = LEDC_HS_CH5_GPIO,
-            .speed_mode = LEDC_HS_MODE,
-            .hpoint     = 0,
-            .timer_sel  = LEDC_HS_TIMER,
-            .flags.output_invert = 0
-        },
-    };
+/*
+ * Software fade engine. The LEDC's own fade restarts from scratch whenever a
+ * new target lands mid-fade and reports completion from an ISR, so instead
+ * every channel keeps its effective duty here and one periodic tick walks
+ * them all towards their targets at each channel's own rate. A new target
+ * simply changes where the walk is heading.
+ */
+typedef struct {
+    fanDuty_t current;          /* what the output is driving now */
+    fanDuty_t target;
+    uint32_t rate;              /* Q16 per second, 0 = jump straight to the target */
+    uint32_t counts;            /* duty last written to the output */
+    uint32_t hpoint;            /* phase last written to the output */
+    uint8_t kick;               /* pwm_kick_t */
+    uint8_t kickTries;          /* kicks that ran their full length with no tach reading */
+    uint16_t kickMs;            /* full duty kick when starting from rest, 0 = off */
+    int64_t kickAt;             /* us the kick, or the rest before the next one, started */
+    volatile uint32_t rpm;      /* last tach reading, 0 if none */
+} pwm_fade_t;
 
+typedef enum {
+    PWM_KICK_NONE = 0,
+    PWM_KICK_WAITING,           /* held at 0 until the previous kick is far enough behind */
+    PWM_KICK_RUNNING,
+    PWM_KICK_BACKOFF,           /* unconfirmed, resting before the next try */
+    PWM_KICK_FAILED,            /* never confirmed, held at full duty until the tach sees it turn */
+} pwm_kick_t;
 
+static pwm_fade_t fade[NUM_TARGETS];
+/* recursive so a group update can use the setters while it holds the lock */
+static SemaphoreHandle_t fadeLock;
+static bool grouped;
+static esp_timer_handle_t fadeTimer;
+static int64_t fadeLast;
+static int64_t lastKick;
+
+#ifdef CONFIG_FANCTRL_PWM_PHASE_STAGGER
 /*
- * This callback function will be called when fade operation has ended
- * Use callback only if you are aware it is being called inside an ISR
- * Otherwise, you can use a semaphore to unblock tasks
+ * With every channel on one timer and hpoint 0, all the fans switch on at
+ * the same count and their inrush adds up into one spike on the supply.
+ * Laying the active channels' high times end to end around the period
+ * instead means only as many fans are drawing at once as the total duty
+ * needs. Channels that are off or fully on draw steadily and take no slot.
  */
-static bool cb_ledc_fade_end_event(const ledc_cb_param_t *param, void *user_arg)
+static void pwm_phase_layout(const uint32_t *counts, uint32_t *hpoint)
 {
-    portBASE_TYPE taskAwoken = pdFALSE;
-    ESP_LOGI(TAG, "Fade event %d, channel: %d, duty: %d", param->event, param->channel, param->duty);
-    if (param->event == LEDC_FADE_END_EVT) {
-        ESP_LOGI(TAG, "LEDC fade end event. Channel: %d, duty: %d", param->channel, param->duty);
+    uint32_t at = 0;
+    for (uint8_t ch = 0; ch < board.channels; ch++) {
+        if (counts[ch] == 0 || counts[ch] >= PWM_DUTY_FULL) {
+            continue;
+        }
+        hpoint[ch] = at;
+        at = (at + counts[ch]) % (PWM_DUTY_FULL + 1);
     }
-    return (taskAwoken == pdTRUE);
 }
+#endif
 
-esp_err_t StartPWM(void)
+/* write out every channel whose duty or phase moved, called with fadeLock held */
+static esp_err_t pwm_flush(void)
 {
-    int ch;
+    uint32_t counts[NUM_TARGETS], hpoint[NUM_TARGETS];
+    esp_err_t ret = ESP_OK;
 
-    /*
-     * Prepare and set configuration of timers
-     * that will be used by LED Controller
-     */
-    ledc_timer_config_t ledc_timer = {
-        .duty_resolution = LEDC_TIMER_8_BIT, // resolution of PWM duty
-        .freq_hz = 5000,                      // frequency of PWM signal
-        .speed_mode = LEDC_HS_MODE,           // timer mode
-        .timer_num = LEDC_HS_TIMER,            // timer index
-        .clk_cfg = LEDC_AUTO_CLK,              // Auto select the source clock
-    };
-    // Set configuration of timer0 for high speed channels
-    ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
+    for (uint8_t ch = 0; ch < board.channels; ch++) {
+        counts[ch] = pwm_to_counts(fade[ch].current);
+        hpoint[ch] = 0;
+    }
+#ifdef CONFIG_FANCTRL_PWM_PHASE_STAGGER
+    pwm_phase_layout(counts, hpoint);
+#endif
+    for (uint8_t ch = 0; ch < board.channels; ch++) {
+        if (counts[ch] == fade[ch].counts && hpoint[ch] == fade[ch].hpoint) {
+            continue;
+        }
+        esp_err_t err = pwmBackend->write(ch, counts[ch], hpoint[ch]);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "PWM write failed on channel %d: %d", ch, err);
+            ret = err;
+            continue;
+        }
+        fade[ch].counts = counts[ch];
+        fade[ch].hpoint = hpoint[ch];
+    }
+    return ret;
+}
 
-    // Set LED Controller with previously prepared configuration
-    for (ch = 0; ch < LEDC_TEST_CH_NUM; ch++) {
-        ESP_LOGD(TAG, "Setting up LEDC Channel %d", ch);
-        ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel[ch]));
+/*
+ * Many fans won't start from rest at a low duty and just sit stalled. Set
+ * the new target and, when the fan is stopped and being asked to turn at
+ * less than full duty, start it with a full duty kick first. Returns true
+ * while a kick owns the output, the tick drops it to the target afterwards.
+ * A kick the tach never confirms is retried after a growing rest, and if
+ * none of the tries take the output is held at full duty rather than left
+ * at a duty the fan can't start at. Called with fadeLock held.
+ */
+static bool pwm_kick(uint8_t channel, fanDuty_t duty)
+{
+    pwm_fade_t *f = &fade[channel];
+    f->target = duty;
+    if (f->kick != PWM_KICK_NONE) {
+        if (duty > 0) {
+            return true;
+        }
+        /* switched off again before it got going */
+        f->kick = PWM_KICK_NONE;
+        f->kickTries = 0;
+        f->current = 0;
+        return true;
+    }
+    if (f->kickMs == 0 || duty == 0 || duty == FAN_DUTY_MAX || f->current != 0 || f->rpm != 0) {
+        return false;
     }
+    f->kick = PWM_KICK_WAITING;
+    return true;
+}
 
-    // Initialize fade service.
-    ESP_ERROR_CHECK(ledc_fade_func_install(0));
-    ledc_cbs_t callbacks = {
-        .fade_cb = cb_ledc_fade_end_event
-    };
+/* runs in the esp_timer task, never in an ISR */
+static void pwm_fade_tick(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - fadeLast;
+    bool moved = false;
+    fadeLast = now;
 
-    for (ch = 0; ch < LEDC_TEST_CH_NUM; ch++) {
-        ESP_LOGD(TAG, "Installing Fade Callback for Channel %d", ch);
-        ESP_ERROR_CHECK(ledc_cb_register(ledc_channel[ch].speed_mode, ledc_channel[ch].channel, &callbacks, NULL));
-    }
-    ESP_LOGI(TAG, "LEDC PWM setup complete");
-#if 0
-    while (1) {
-        printf("1. LEDC fade up to duty = %d\n", LEDC_TEST_DUTY);
-        for (ch = 0; ch < LEDC_TEST_CH_NUM; ch++) {
-            ledc_set_fade_with_time(ledc_channel[ch].speed_mode,
-                    ledc_channel[ch].channel, LEDC_TEST_DUTY, LEDC_TEST_FADE_TIME);
-            ledc_fade_start(ledc_channel[ch].speed_mode,
-                    ledc_channel[ch].channel, LEDC_FADE_NO_WAIT);
+    xSemaphoreTakeRecursive(fadeLock, portMAX_DELAY);
+    for (uint8_t ch = 0; ch < board.channels; ch++) {
+        pwm_fade_t *f = &fade[ch];
+        if (f->kick == PWM_KICK_WAITING) {
+            /* one fan at a time, so the kicks' inrush doesn't stack up */
+            if (lastKick == 0 || now - lastKick >= PWM_KICK_STAGGER_MS * 1000) {
+                f->kick = PWM_KICK_RUNNING;
+                f->kickAt = now;
+                f->current = FAN_DUTY_MAX;
+                lastKick = now;
+                moved = true;
+            }
+            continue;
         }
-
-        for (int i = 0; i < LEDC_TEST_CH_NUM; i++) {
-            xSemaphoreTake(counting_sem, portMAX_DELAY);
+        if (f->kick == PWM_KICK_RUNNING) {
+            /* cut short once the tach shows it turning, otherwise run the full time */
+            int64_t kicked = now - f->kickAt;
+            if (f->rpm > 0 && kicked >= f->kickMs * 1000 / PWM_KICK_MIN_DIVISOR) {
+                f->kick = PWM_KICK_NONE;
+                f->kickTries = 0;
+                f->current = f->target;
+                moved = true;
+            } else if (kicked >= f->kickMs * 1000) {
+                if (++f->kickTries < PWM_KICK_RETRIES) {
+                    ESP_LOGW(TAG, "Channel %d: no tach after a %d ms kick, retrying", ch, f->kickMs);
+                    f->kick = PWM_KICK_BACKOFF;
+                    f->kickAt = now;
+                    f->current = 0;
+                } else {
+                    ESP_LOGE(TAG, "Channel %d: fan did not start after %d kicks, holding full duty", ch, f->kickTries);
+                    f->kick = PWM_KICK_FAILED;
+                }
+                moved = true;
+            }
+            continue;
         }
-
-        printf("2. LEDC fade down to duty = 0\n");
-        for (ch = 0; ch < LEDC_TEST_CH_NUM; ch++) {
-            ledc_set_fade_with_time(ledc_channel[ch].speed_mode,
-                    ledc_channel[ch].channel, 0, LEDC_TEST_FADE_TIME);
-            ledc_fade_start(ledc_channel[ch].speed_mode,
-                    ledc_channel[ch].channel, LEDC_FADE_NO_WAIT);
+        if (f->kick == PWM_KICK_BACKOFF) {
+            /* the rest doubles with every try */
+            if (now - f->kickAt >= ((int64_t)f->kickMs * 1000) << f->kickTries) {
+                f->kick = PWM_KICK_WAITING;
+            }
+            continue;
         }
-
-        for (int i = 0; i < LEDC_TEST_CH_NUM; i++) {
-            xSemaphoreTake(counting_sem, portMAX_DELAY);
+        if (f->kick == PWM_KICK_FAILED) {
+            if (f->rpm > 0) {
+                ESP_LOGI(TAG, "Channel %d: fan started", ch);
+                f->kick = PWM_KICK_NONE;
+                f->kickTries = 0;
+                f->current = f->target;
+                moved = true;
+            }
+            continue;
         }
-
-        printf("3. LEDC set duty = %d without fade\n", LEDC_TEST_DUTY);
-        for (ch = 0; ch < LEDC_TEST_CH_NUM; ch++) {
-            ledc_set_duty(ledc_channel[ch].speed_mode, ledc_channel[ch].channel, LEDC_TEST_DUTY);
-            ledc_update_duty(ledc_channel[ch].speed_mode, ledc_channel[ch].channel);
+        if (f->current == f->target) {
+            continue;
         }
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
-
-        printf("4. LEDC set duty = 0 without fade\n");
-        for (ch = 0; ch < LEDC_TEST_CH_NUM; ch++) {
-            ledc_set_duty(ledc_channel[ch].speed_mode, ledc_channel[ch].channel, 0);
-            ledc_update_duty(ledc_channel[ch].speed_mode, ledc_channel[ch].channel);
+        int64_t step = (int64_t)f->rate * elapsed / 1000000;
+        if (f->rate == 0) {
+            /* immediate, the rate was cleared part way through a fade */
+            step = FAN_DUTY_MAX;
+        } else if (step < 1) {
+            step = 1;
+        }
+        if (f->target > f->current) {
+            f->current = f->target - f->current > step ? f->current + step : f->target;
+        } else {
+            f->current = f->current - f->target > step ? f->current - step : f->target;
         }
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        moved = true;
     }
-#endif
-    for (ch = 0; ch < LEDC_TEST_CH_NUM; ch++) {
-        ESP_LOGD(TAG, "Starting Fade for Channel %d", ch);
-        ledc_set_duty(ledc_channel[ch].speed_mode, ledc_channel[ch].channel, pow(2, LEDC_TIMER_8_BIT) - 1);
-        ledc_update_duty(ledc_channel[ch].speed_mode, ledc_channel[ch].channel);
+    if (moved) {
+        pwm_flush();
+    }
+    xSemaphoreGiveRecursive(fadeLock);
+}
+
+/*
+ * One output per fan on the board, all on the one timer so they share
+ * frequency and resolution. Polarity is set in the output stage so duty
+ * always means the same thing to the rest of the firmware. Every fan
+ * starts at full duty until the control loop says otherwise.
+ */
+static esp_err_t pwm_route(void)
+{
+    for (int ch = 0; ch < board.channels; ch++) {
+        esp_err_t err = pwmBackend->channel(ch, board.ch[ch].pwmPin, board.ch[ch].invert, PWM_DUTY_FULL);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Channel %d on GPIO %d failed: %s", ch, board.ch[ch].pwmPin, esp_err_to_name(err));
+            return err;
+        }
+        fade[ch] = (pwm_fade_t) {
+            .current = FAN_DUTY_MAX,
+            .target = FAN_DUTY_MAX,
+            .rate = PWM_FADE_RATE_DEFAULT,
+            .counts = PWM_DUTY_FULL,
+            .hpoint = 0,
+            .kickMs = PWM_KICK_MS_DEFAULT,
+        };
     }
     return ESP_OK;
 }
 
-esp_err_t pwm_set_duty(uint8_t channel, uint8_t duty)
+esp_err_t StartPWM(void)
 {
-    if (channel >= LEDC_TEST_CH_NUM) {
-        ESP_LOGW(TAG, "Invalid Channel %d", channel);
-        return ESP_ERR_INVALID_ARG;
+    esp_err_t err;
+
+    /* called again after the layout changes: the fade engine is already running, just move the outputs */
+    if (fadeLock != NULL) {
+        xSemaphoreTakeRecursive(fadeLock, portMAX_DELAY);
+        err = pwm_route();
+        xSemaphoreGiveRecursive(fadeLock);
+        if (err == ESP_OK) {
+            ESP_LOGI(TAG, "PWM moved to the current layout, %d channels", board.channels);
+        }
+        return err;
     }
-    esp_err_t err = ledc_set_fade_with_time(ledc_channel[channel].speed_mode, ledc_channel[channel].channel, duty, LEDC_TEST_FADE_TIME);
+
+    err = pwmBackend->timer(PWM_FREQ_HZ, PWM_RESOLUTION_BITS);
     if (err != ESP_OK) {
-        ESP_LOGW(TAG, "ledc_set_fade_with_time failed: %d", err);
+        ESP_LOGE(TAG, "PWM timer setup failed: %s", esp_err_to_name(err));
         return err;
     }
-    ESP_LOGI(TAG, "Setting duty for channel %d to %d", channel, duty);
-    err = ledc_update_duty(ledc_channel[channel].speed_mode, ledc_channel[channel].channel);
+    /* returned before anything else is created, so StartPWM can be called again on another layout */
+    err = pwm_route();
     if (err != ESP_OK) {
-        ESP_LOGW(TAG, "ledc_update_duty failed: %d", err);
         return err;
     }
+
+    fadeLock = xSemaphoreCreateRecursiveMutex();
+    if (fadeLock == NULL) {
+        ESP_LOGE(TAG, "Failed to create fade lock");
+        return ESP_FAIL;
+    }
+    const esp_timer_create_args_t fade_timer_args = {
+        .callback = &pwm_fade_tick,
+        .name = "pwmfade"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&fade_timer_args, &fadeTimer));
+    fadeLast = esp_timer_get_time();
+    ESP_ERROR_CHECK(esp_timer_start_periodic(fadeTimer, PWM_FADE_TICK_MS * 1000));
+
+    ESP_LOGI(TAG, "PWM setup complete: %d Hz, %d bit", PWM_FREQ_HZ, PWM_RESOLUTION_BITS);
+    return ESP_OK;
+}
+
+esp_err_t pwm_set_duty(uint8_t channel, fanDuty_t duty)
+{
+    if (channel >= board.channels) {
+        ESP_LOGW(TAG, "Invalid Channel %d", channel);
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_OK;
+    ESP_LOGD(TAG, "Setting duty for channel %d to %d", channel, duty);
+    xSemaphoreTakeRecursive(fadeLock, portMAX_DELAY);
+    if (!pwm_kick(channel, duty) && fade[channel].rate == 0) {
+        fade[channel].current = duty;
+    }
+    if (!grouped) {
+        err = pwm_flush();
+    }
+    xSemaphoreGiveRecursive(fadeLock);
+    return err;
+}
+
+/* skip the fade - used by the closed loop controller which does its own ramping */
+esp_err_t pwm_set_duty_immediate(uint8_t channel, fanDuty_t duty)
+{
+    if (channel >= board.channels) {
+        ESP_LOGW(TAG, "Invalid Channel %d", channel);
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_OK;
+    xSemaphoreTakeRecursive(fadeLock, portMAX_DELAY);
+    if (!pwm_kick(channel, duty)) {
+        fade[channel].current = duty;
+    }
+    if (!grouped) {
+        err = pwm_flush();
+    }
+    xSemaphoreGiveRecursive(fadeLock);
+    return err;
+}
+
+esp_err_t pwm_set_fade_rate(uint8_t channel, uint32_t rate)
+{
+    if (channel >= board.channels) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_OK;
+    xSemaphoreTakeRecursive(fadeLock, portMAX_DELAY);
+    fade[channel].rate = rate;
+    if (rate == 0 && fade[channel].kick == PWM_KICK_NONE && fade[channel].current != fade[channel].target) {
+        /* immediate from now on, so a fade in progress finishes here rather than a step a tick */
+        fade[channel].current = fade[channel].target;
+        if (!grouped) {
+            err = pwm_flush();
+        }
+    }
+    xSemaphoreGiveRecursive(fadeLock);
+    return err;
+}
+
+esp_err_t pwm_set_kick(uint8_t channel, uint16_t ms)
+{
+    if (channel >= board.channels) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTakeRecursive(fadeLock, portMAX_DELAY);
+    fade[channel].kickMs = ms;
+    xSemaphoreGiveRecursive(fadeLock);
     return ESP_OK;
 }
 
-uint8_t pwm_get_duty(uint8_t channel) 
+void pwm_note_rpm(uint8_t channel, uint32_t rpm)
 {
-    if (channel >= LEDC_TEST_CH_NUM) {
+    if (channel < board.channels) {
+        fade[channel].rpm = rpm;
+    }
+}
+
+void pwm_group_begin(void)
+{
+    xSemaphoreTakeRecursive(fadeLock, portMAX_DELAY);
+    grouped = true;
+}
+
+esp_err_t pwm_group_commit(void)
+{
+    grouped = false;
+    esp_err_t err = pwm_flush();
+    xSemaphoreGiveRecursive(fadeLock);
+    return err;
+}
+
+fanDuty_t pwm_get_duty(uint8_t channel) 
+{
+    if (channel >= board.channels) {
+        return 0;
+    }
+    /* a single aligned 16 bit read, no need for the lock */
+    return fade[channel].current;
+}
+
+bool pwm_kick_failed(uint8_t channel)
+{
+    if (channel >= board.channels) {
+        return false;
+    }
+    return fade[channel].kick == PWM_KICK_FAILED;
+}
+
+fanDuty_t pwm_get_target(uint8_t channel)
+{
+    if (channel >= board.channels) {
         return 0;
     }
-    return ledc_get_duty(ledc_channel[channel].speed_mode, ledc_channel[channel].channel);
-}
\ No newline at end of file
+    return fade[channel].target;
+}
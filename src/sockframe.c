@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <esp_log.h>
+#include <pb_decode.h>
+#include "sockframe.h"
+
+static const char* TAG = "SockFrame";
+
+typedef struct {
+    const rxring_t *ring;
+    uint32_t offset;
+} ring_stream_t;
+
+/* pb_istream_t callback reading a frame that wraps the end of the ring, nanopb does the bounds checks */
+static bool ring_stream_read(pb_istream_t *stream, pb_byte_t *buf, size_t count) {
+    ring_stream_t *state = stream->state;
+    if (buf != NULL) {
+        rxring_peek(state->ring, state->offset, buf, count);
+    }
+    state->offset += count;
+    return true;
+}
+
+bool sock_decode(const rxring_t *ring, uint32_t offset, uint32_t len, espmsg_EspReq_Msg *request) {
+    if (len == 0) {
+        ESP_LOGW(TAG, "Empty packet");
+        return false;
+    }
+    const uint8_t *body = rxring_span(ring, offset, len);
+    if (body != NULL) {
+        pb_istream_t input = pb_istream_from_buffer(body, len);
+        if (pb_decode(&input, espmsg_EspReq_Msg_fields, request)) {
+            return true;
+        }
+        ESP_LOGW(TAG, "Decoding failed: %s", PB_GET_ERROR(&input));
+        return false;
+    }
+    ring_stream_t state = { .ring = ring, .offset = offset };
+    pb_istream_t input = { .callback = ring_stream_read, .state = &state, .bytes_left = len };
+    if (pb_decode(&input, espmsg_EspReq_Msg_fields, request)) {
+        return true;
+    }
+    ESP_LOGW(TAG, "Decoding failed: %s", PB_GET_ERROR(&input));
+    return false;
+}
@@ -1,82 +1,399 @@
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <freertos/queue.h>
 #include <esp_err.h>
 #include <esp_log.h>
 #include <esp_timer.h>
-#include <driver/pcnt.h>
+#include <soc/soc_caps.h>
 #include "tacho.h"
 #include "target.h"
+#include "latency.h"
+#include "board.h"
+#include "backend.h"
+
+/*
+ * Parallel mode gives every fan its own counter unit counting all the time and
+ * harvests them together on one periodic timer. Round robin shares unit 0
+ * and moves it between the pins, for chips without a unit per channel.
+ * Period mode timestamps the tach edges from a GPIO interrupt and works the
+ * speed out from the time between them.
+ */
+#if CONFIG_FANCTRL_TACHO_PERIOD
+#define TACHO_PERIOD 1
+#define TACHO_PARALLEL 0
+#elif CONFIG_FANCTRL_TACHO_PARALLEL && SOC_PCNT_UNITS_PER_GROUP >= NUM_TARGETS
+#define TACHO_PERIOD 0
+#define TACHO_PARALLEL 1
+#else
+#define TACHO_PERIOD 0
+#define TACHO_PARALLEL 0
+#endif
+
+/*
+ * One free running periodic timer drives every mode. Gates are whole numbers
+ * of ticks, so the schedule never drifts and a late wake-up only shortens
+ * the wait for the next tick instead of lengthening every gate after it.
+ */
+#define TACHO_TICK_US           50000
+/* counting modes pick each channel's gate from its last speed, within these */
+#define TACHO_GATE_MIN_US       TACHO_TICK_US
+#define TACHO_GATE_MAX_US       1000000
+/* the unit resets to 0 when it reaches this, harvests work on the difference */
+#define TACHO_COUNTER_LIMIT     32767
 
 
 static const char* TAG = "Tacho";
 void vTaskTacho(void* pvParameters);
 
-QueueHandle_t xTachoQueue;
+static TaskHandle_t xTachoTask;
 esp_timer_handle_t tacho_timer;
-
-typedef struct TimeEvent_t {
-    uint8_t channel;
-    int16_t count;
-} TimeEvent_t;
+static int64_t tickStart;           /* when the periodic timer was started */
+static uint32_t tickCount;          /* ticks handled since */
 
 uint32_t count = 0;
 
-typedef struct pinmap_t {
-    uint8_t pin;
-} pinmap_t;
+uint8_t curChan = 0;
 
-pinmap_t pinmap[] = {
-    { 25 },
-    { 32 },
-    { 4  },
-    { 0  },
-    { 2  },
-    { 21 }
-};
+static tacho_stats_t tachoStats[NUM_TARGETS];
+static int64_t lastReading[NUM_TARGETS];
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED;
 
-uint8_t curChan = 0;
+/* record a reading: window is the time it covers, error the worst case RPM error */
+static void tacho_account(uint8_t channel, uint32_t window, uint32_t error) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&statsLock);
+    tachoStats[channel].window = window;
+    tachoStats[channel].error = error;
+    if (lastReading[channel] != 0 && now > lastReading[channel]) {
+        tachoStats[channel].rate = (uint32_t)(1000000000LL / (now - lastReading[channel]));
+    }
+    portEXIT_CRITICAL(&statsLock);
+    lastReading[channel] = now;
+}
+
+/*
+ * Every reading lands in the channel's raw ring, then goes through the
+ * configured filter before it is handed to the target task. A zero reading
+ * is a stopped fan rather than noise, so it restarts the filter and is
+ * passed straight on for the stall detector.
+ */
+typedef struct {
+    tacho_sample_t raw[TACHO_RAW_SAMPLES];
+    uint32_t samples;           /* total readings, the ring head is samples % TACHO_RAW_SAMPLES */
+} tacho_ring_t;
+
+static tacho_ring_t rawRing[NUM_TARGETS];
+static uint8_t filterFill[NUM_TARGETS];     /* readings since the filter restarted */
+#if CONFIG_FANCTRL_RPM_FILTER_EMA
+static uint32_t filterEma[NUM_TARGETS];     /* Q8 */
+#endif
+
+static uint32_t tacho_filter(uint8_t channel, uint32_t rpm) {
+    if (rpm == 0) {
+        filterFill[channel] = 0;
+        return 0;
+    }
+#if CONFIG_FANCTRL_RPM_FILTER_MEDIAN
+    if (filterFill[channel] < CONFIG_FANCTRL_RPM_MEDIAN_N) {
+        filterFill[channel]++;
+    }
+    /* the newest readings are already in the ring - sort a copy of them */
+    uint32_t window[CONFIG_FANCTRL_RPM_MEDIAN_N];
+    uint8_t n = filterFill[channel];
+    uint32_t head = rawRing[channel].samples;
+    for (uint8_t i = 0; i < n; i++) {
+        uint32_t v = rawRing[channel].raw[(head - 1 - i) % TACHO_RAW_SAMPLES].rpm;
+        int8_t j = i - 1;
+        while (j >= 0 && window[j] > v) {
+            window[j + 1] = window[j];
+            j--;
+        }
+        window[j + 1] = v;
+    }
+    return window[n / 2];
+#elif CONFIG_FANCTRL_RPM_FILTER_EMA
+    if (filterFill[channel] == 0) {
+        filterFill[channel] = 1;
+        filterEma[channel] = rpm << 8;
+    } else {
+        int32_t delta = (int32_t)(rpm << 8) - (int32_t)filterEma[channel];
+        filterEma[channel] += delta >> CONFIG_FANCTRL_RPM_EMA_SHIFT;
+    }
+    return (filterEma[channel] + 128) >> 8;
+#else
+    return rpm;
+#endif
+}
+
+/* record a raw reading and pass the filtered value on */
+static void tacho_report(uint8_t channel, uint32_t rpm) {
+    portENTER_CRITICAL(&statsLock);
+    tacho_sample_t *slot = &rawRing[channel].raw[rawRing[channel].samples % TACHO_RAW_SAMPLES];
+    slot->time = (uint32_t)(esp_timer_get_time() / 1000);
+    slot->rpm = rpm;
+    rawRing[channel].samples++;
+    portEXIT_CRITICAL(&statsLock);
+    ESP_ERROR_CHECK(target_send_rpm(channel, tacho_filter(channel, rpm)));
+}
+
+esp_err_t tacho_get_raw(uint8_t channel, tacho_sample_t samples[TACHO_RAW_SAMPLES], uint8_t *count) {
+    if (channel >= NUM_TARGETS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&statsLock);
+    uint32_t total = rawRing[channel].samples;
+    uint8_t n = total < TACHO_RAW_SAMPLES ? total : TACHO_RAW_SAMPLES;
+    for (uint8_t i = 0; i < n; i++) {
+        samples[i] = rawRing[channel].raw[(total - n + i) % TACHO_RAW_SAMPLES];
+    }
+    portEXIT_CRITICAL(&statsLock);
+    *count = n;
+    return ESP_OK;
+}
+
+esp_err_t tacho_get_stats(uint8_t channel, tacho_stats_t *stats) {
+    if (channel >= NUM_TARGETS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&statsLock);
+    memcpy(stats, &tachoStats[channel], sizeof(tacho_stats_t));
+    portEXIT_CRITICAL(&statsLock);
+    return ESP_OK;
+}
+
+#if !TACHO_PERIOD
+static uint32_t gateUs[NUM_TARGETS];
+
+/*
+ * A count is only ever out by one pulse, so a gate long enough for
+ * 1000 / CONFIG_FANCTRL_TACHO_PRECISION pulses holds the reading within the
+ * target precision. Unknown or stopped fans get the longest gate.
+ */
+static uint32_t tacho_pick_gate(uint8_t channel, uint32_t rpm) {
+    if (rpm == 0) {
+        return TACHO_GATE_MAX_US;
+    }
+    uint64_t pulses = (1000 + CONFIG_FANCTRL_TACHO_PRECISION - 1) / CONFIG_FANCTRL_TACHO_PRECISION;
+    uint64_t gate = pulses * 60 * 1000000 / ((uint64_t)rpm * board.ch[channel].ppr);
+    if (gate < TACHO_GATE_MIN_US) {
+        return TACHO_GATE_MIN_US;
+    }
+    if (gate > TACHO_GATE_MAX_US) {
+        return TACHO_GATE_MAX_US;
+    }
+    return (gate + TACHO_TICK_US - 1) / TACHO_TICK_US * TACHO_TICK_US;
+}
+
+/* counted pulses over a window to RPM, picking the channel's next gate as it goes */
+static uint32_t tacho_count_rpm(uint8_t channel, int32_t pulses, int64_t window) {
+    int64_t jitter = window - gateUs[channel];
+    latency_record(LATENCY_STAGE_TACHO_GATE, jitter < 0 ? -jitter : jitter);
+    uint32_t rpm = (uint32_t)((int64_t)pulses * 60 * 1000000 / (window * board.ch[channel].ppr));
+    gateUs[channel] = tacho_pick_gate(channel, rpm);
+    tacho_account(channel, window, (uint32_t)(60 * 1000000 / (window * board.ch[channel].ppr)));
+    return rpm;
+}
+#endif
+
+#if TACHO_PARALLEL
+static int16_t lastCount[NUM_TARGETS];
+static int64_t lastHarvest[NUM_TARGETS];
+
+static esp_err_t tacho_config_units(void) {
+    if (countBackend->units < board.channels) {
+        ESP_LOGE(TAG, "%d counter units for %d channels", countBackend->units, board.channels);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    for (uint8_t i = 0; i < board.channels; i++) {
+        esp_err_t err = countBackend->setup(i, board.ch[i].tachPin, TACHO_COUNTER_LIMIT);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Channel %d on GPIO %d failed: %s", i, board.ch[i].tachPin, esp_err_to_name(err));
+            return err;
+        }
+        lastCount[i] = 0;
+        gateUs[i] = TACHO_GATE_MAX_US;
+    }
+    /* start them back to back so every window begins together */
+    for (uint8_t i = 0; i < board.channels; i++) {
+        esp_err_t err = countBackend->resume(i);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    int64_t now = esp_timer_get_time();
+    for (uint8_t i = 0; i < board.channels; i++) {
+        lastHarvest[i] = now;
+    }
+    return ESP_OK;
+}
+
+/* read the units whose gate has run out, without stopping them, and turn the pulses into RPM */
+static void tacho_harvest(void) {
+    for (uint8_t i = 0; i < board.channels; i++) {
+        int64_t now = esp_timer_get_time();
+        int64_t window = now - lastHarvest[i];
+        if (window + TACHO_TICK_US / 2 < gateUs[i]) {
+            continue;
+        }
+        int16_t count;
+        ESP_ERROR_CHECK(countBackend->read(i, &count));
+        lastHarvest[i] = now;
+        int32_t pulses = count - lastCount[i];
+        if (pulses < 0) {
+            pulses += TACHO_COUNTER_LIMIT;
+        }
+        lastCount[i] = count;
+        uint32_t rpm = tacho_count_rpm(i, pulses, window);
+        /* zero is sent too, so a stalled fan is seen rather than going quiet */
+        ESP_LOGD(TAG, "Channel: %d RPM: %d - %d", i, rpm, pulses);
+        tacho_report(i, rpm);
+    }
+}
+#endif
+
+#if TACHO_PERIOD
+/* more than enough edges for the average, kept as a power of two for the ring index */
+#define TACHO_EDGE_RING         16
+/* edges closer than this are noise - 60000 RPM at 2 pulses per rev */
+#define TACHO_EDGE_MIN_US       500
+/* no edge for this long and the last period no longer describes the fan */
+#define TACHO_EDGE_TIMEOUT_US   2000000
+/* worst case GPIO interrupt latency, for the error bound */
+#define TACHO_EDGE_JITTER_US    10
+
+typedef struct {
+    int64_t stamp[TACHO_EDGE_RING];
+    uint32_t edges;             /* total accepted edges, the ring head is edges % TACHO_EDGE_RING */
+} tacho_edges_t;
+
+static tacho_edges_t edgeLog[NUM_TARGETS];
+static uint32_t harvestedEdges[NUM_TARGETS];
+static bool edgeStopped[NUM_TARGETS];      /* a 0 RPM reading has been sent since the last edge */
+static int64_t edgeStart;
+static portMUX_TYPE edgeLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void IRAM_ATTR tacho_edge_isr(void *arg) {
+    uint8_t channel = (uint8_t)(uintptr_t)arg;
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL_ISR(&edgeLock);
+    tacho_edges_t *log = &edgeLog[channel];
+    if (log->edges == 0 || now - log->stamp[(log->edges - 1) % TACHO_EDGE_RING] >= TACHO_EDGE_MIN_US) {
+        log->stamp[log->edges % TACHO_EDGE_RING] = now;
+        log->edges++;
+    }
+    portEXIT_CRITICAL_ISR(&edgeLock);
+}
+
+static esp_err_t tacho_config_edges(void) {
+    for (uint8_t i = 0; i < board.channels; i++) {
+        esp_err_t err = countBackend->edges(board.ch[i].tachPin, tacho_edge_isr, (void *)(uintptr_t)i);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Channel %d on GPIO %d failed: %s", i, board.ch[i].tachPin, esp_err_to_name(err));
+            return err;
+        }
+    }
+    edgeStart = esp_timer_get_time();
+    return ESP_OK;
+}
+
+/* RPM from the span of the newest CONFIG_FANCTRL_TACHO_PERIOD_EDGES edge intervals */
+static void tacho_harvest(void) {
+    int64_t now = esp_timer_get_time();
+    for (uint8_t i = 0; i < board.channels; i++) {
+        tacho_edges_t log;
+        portENTER_CRITICAL(&edgeLock);
+        memcpy(&log, &edgeLog[i], sizeof(tacho_edges_t));
+        portEXIT_CRITICAL(&edgeLock);
+        int64_t newest = log.edges ? log.stamp[(log.edges - 1) % TACHO_EDGE_RING] : edgeStart;
+        if (log.edges == harvestedEdges[i] || log.edges < 2 || now - newest > TACHO_EDGE_TIMEOUT_US) {
+            /* no edges for a while - report the fan stopped, once */
+            if (!edgeStopped[i] && now - newest > TACHO_EDGE_TIMEOUT_US) {
+                edgeStopped[i] = true;
+                harvestedEdges[i] = log.edges;
+                tacho_account(i, TACHO_EDGE_TIMEOUT_US, 60 * 1000000 / (TACHO_EDGE_TIMEOUT_US * board.ch[i].ppr));
+                tacho_report(i, 0);
+            }
+            continue;
+        }
+        harvestedEdges[i] = log.edges;
+        edgeStopped[i] = false;
+        uint32_t intervals = log.edges - 1;
+        if (intervals > CONFIG_FANCTRL_TACHO_PERIOD_EDGES) {
+            intervals = CONFIG_FANCTRL_TACHO_PERIOD_EDGES;
+        }
+        int64_t span = newest - log.stamp[(log.edges - 1 - intervals) % TACHO_EDGE_RING];
+        if (span <= 0) {
+            continue;
+        }
+        uint32_t rpm = (uint32_t)((int64_t)intervals * 60 * 1000000 / (span * board.ch[i].ppr));
+        ESP_LOGD(TAG, "Channel: %d RPM: %d - %d edges over %lld us", i, rpm, intervals, span);
+        /* each end of the span can be off by the interrupt latency */
+        tacho_account(i, span, (uint32_t)((uint64_t)rpm * 2 * TACHO_EDGE_JITTER_US / span));
+        tacho_report(i, rpm);
+    }
+}
+#endif
+
+#if !TACHO_PARALLEL && !TACHO_PERIOD
+static int64_t gateStart;
+
+/* once the current channel's gate is up, read it and move unit 0 on to the next pin */
+static void tacho_harvest(void) {
+    if (esp_timer_get_time() - gateStart + TACHO_TICK_US / 2 < gateUs[curChan]) {
+        return;
+    }
+    int16_t count;
+    ESP_ERROR_CHECK(countBackend->pause(0));
+    int64_t gateEnd = esp_timer_get_time();
+    ESP_ERROR_CHECK(countBackend->read(0, &count));
+    uint32_t rpm = tacho_count_rpm(curChan, count, gateEnd - gateStart);
+    ESP_LOGD(TAG, "Channel: %d RPM: %d - %d", curChan, rpm, count);
+    tacho_report(curChan, rpm);
+    curChan++;
+    if (curChan >= board.channels) {
+        curChan = 0;
+    }
+    ESP_ERROR_CHECK(countBackend->set_pin(0, board.ch[curChan].tachPin));
+    ESP_ERROR_CHECK(countBackend->clear(0));
+    ESP_ERROR_CHECK(countBackend->resume(0));
+    gateStart = esp_timer_get_time();
+}
+#endif
 
 esp_err_t StartTacho() {
+    esp_err_t err;
+
     ESP_LOGD(TAG, "Starting tacho");
-    xTachoQueue = xQueueCreate(10, sizeof(TimeEvent_t));
-    if (xTachoQueue == NULL) {
-        ESP_LOGE(TAG, "Failed to create Tacho queue");
-        return ESP_FAIL;
+    /* errors come back before the task is created, so StartTacho can be called again on another layout */
+#if TACHO_PERIOD
+    ESP_LOGI(TAG, "Timing %d channels from edge periods", board.channels);
+    err = tacho_config_edges();
+#elif TACHO_PARALLEL
+    ESP_LOGI(TAG, "Sampling %d channels in parallel", board.channels);
+    err = tacho_config_units();
+#else
+    ESP_LOGI(TAG, "Sampling %d channels round robin", board.channels);
+    for (uint8_t i = 0; i < board.channels; i++) {
+        gateUs[i] = TACHO_GATE_MAX_US;
+    }
+    err = countBackend->setup(0, board.ch[curChan].tachPin, 0);
+#endif
+    if (err != ESP_OK) {
+        return err;
     }
-//25, 32, 4, 0, 2, 
-    pcnt_config_t pcnt_config = {
-        .pulse_gpio_num = pinmap[curChan].pin,
-        .ctrl_gpio_num = PCNT_PIN_NOT_USED,
-        .channel = PCNT_CHANNEL_0,
-        .unit = PCNT_UNIT_0,
-        .pos_mode = PCNT_COUNT_DIS,
-        .neg_mode = PCNT_COUNT_INC,
-        .lctrl_mode = PCNT_MODE_KEEP,
-        .hctrl_mode = PCNT_MODE_KEEP,
-        .counter_h_lim = 0,
-        .counter_l_lim = 0,
-    };
-    ESP_ERROR_CHECK(pcnt_unit_config(&pcnt_config));
-    ESP_ERROR_CHECK(pcnt_set_filter_value(PCNT_UNIT_0, 1023));
-    ESP_ERROR_CHECK(pcnt_filter_enable(PCNT_UNIT_0));
-    ESP_ERROR_CHECK(pcnt_counter_pause(PCNT_UNIT_0));
-    ESP_ERROR_CHECK(pcnt_counter_clear(PCNT_UNIT_0));
 
-    xTaskCreate(vTaskTacho, "Tacho", 2048, NULL, 5, NULL);
+    if (xTaskCreate(vTaskTacho, "Tacho", 2048, NULL, 5, &xTachoTask) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create Tacho task");
+        return ESP_FAIL;
+    }
     return ESP_OK;
 }
 
+/* runs in the esp_timer task - just wake the tacho task, it does the work */
 void TachoCallback(void *arg) {
-    TimeEvent_t event;
-    ESP_ERROR_CHECK(pcnt_counter_pause(PCNT_UNIT_0));
-    event.channel = 0;
-    ESP_ERROR_CHECK(pcnt_get_counter_value(PCNT_UNIT_0, &event.count));
-    if (xQueueSend(xTachoQueue, &event, 0) == pdFALSE) {
-        ESP_LOGE(TAG, "Failed to send tacho event");
-    }
+    xTaskNotify(xTachoTask, 0, eIncrement);
 }
 
 
@@ -89,24 +406,23 @@ void vTaskTacho(void* pvParameters) {
     };
 
     ESP_ERROR_CHECK(esp_timer_create(&tacho_timer_args, &tacho_timer));
-
-    ESP_ERROR_CHECK(esp_timer_start_once(tacho_timer, 200000));
-    TimeEvent_t msg;
+#if !TACHO_PARALLEL && !TACHO_PERIOD
+    ESP_ERROR_CHECK(countBackend->resume(0));
+    gateStart = esp_timer_get_time();
+#endif
+    tickStart = esp_timer_get_time();
+    tickCount = 0;
+    ESP_ERROR_CHECK(esp_timer_start_periodic(tacho_timer, TACHO_TICK_US));
     for (;;) {
-        if ( xQueueReceive( xTachoQueue, &(msg), ( TickType_t ) 1000 / portTICK_PERIOD_MS ) == pdPASS ) {
-            if (msg.count > 0) {
-                uint32_t rpm = (msg.count * 5 * 60)/2;
-                ESP_LOGI(TAG, "Channel: %d RPM: %d - %d", curChan, rpm, msg.count);
-                ESP_ERROR_CHECK(target_send_rpm(curChan, rpm));
-            }
-            curChan++;
-            if (curChan > 5) {
-                curChan = 0;
-            }
-            ESP_ERROR_CHECK(pcnt_set_pin(PCNT_UNIT_0, PCNT_CHANNEL_0, pinmap[curChan].pin, PCNT_PIN_NOT_USED));
-            ESP_ERROR_CHECK(pcnt_counter_clear(PCNT_UNIT_0));
-            ESP_ERROR_CHECK(pcnt_counter_resume(PCNT_UNIT_0));
-            ESP_ERROR_CHECK(esp_timer_start_once(tacho_timer, 200000));
+        uint32_t ticks = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        if (ticks == 0) {
+            ESP_LOGW(TAG, "No tacho tick for a second");
+            continue;
         }
+        /* more than one pending means ticks were missed, measure against the newest */
+        tickCount += ticks;
+        int64_t late = esp_timer_get_time() - (tickStart + (int64_t)tickCount * TACHO_TICK_US);
+        latency_record(LATENCY_STAGE_TACHO_WAKE, late > 0 ? late : 0);
+        tacho_harvest();
     }
-}
\ No newline at end of file
+}
@@ -1,179 +1,437 @@
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <freertos/queue.h>
 #include <freertos/semphr.h>
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include "target.h"
 #include "fanconfig.h"
 #include "pwm.h"
+#include "fancurve.h"
+#include "fanpid.h"
+#include "fanlimit.h"
+#include "fanhealth.h"
+#include "fanchar.h"
+#include "board.h"
+#include "fanctrlevents.h"
+#include "latency.h"
 
 static const char* TAG = "Target";
 
-SemaphoreHandle_t targetLock[NUM_TARGETS];
+ESP_EVENT_DEFINE_BASE(TARGET_EVENTS);
 
 target_t targets[NUM_TARGETS] = {
-    {0, 255, 0, 0, 0, 0},
-    {1, 255, 0, 0, 0, 0},
-    {2, 255, 0, 0, 0, 0},
-    {3, 255, 0, 0, 0, 0},
-    {4, 255, 0, 0, 0, 0},
-    {5, 255, 0, 0, 0, 0},
+    {0, FAN_DUTY_MAX, 0, 0, 0, 0, 0, false, 0},
+    {1, FAN_DUTY_MAX, 0, 0, 0, 0, 0, false, 0},
+    {2, FAN_DUTY_MAX, 0, 0, 0, 0, 0, false, 0},
+    {3, FAN_DUTY_MAX, 0, 0, 0, 0, 0, false, 0},
+    {4, FAN_DUTY_MAX, 0, 0, 0, 0, 0, false, 0},
+    {5, FAN_DUTY_MAX, 0, 0, 0, 0, 0, false, 0},
 };
 
 void vTaskTarget(void* pvParameters);
 
-QueueHandle_t xTargetQueue;
+static TaskHandle_t xTargetTask;
 
+#define TARGET_DIRTY_TEMP   (1 << 0)
+#define TARGET_DIRTY_DUTY   (1 << 1)
+#define TARGET_DIRTY_LOAD   (1 << 2)
+#define TARGET_DIRTY_RPM    (1 << 3)
+#define TARGET_DIRTY_CONFIG (1 << 4)
+
+/* notification bits above the per-channel bits */
+#define TARGET_NOTIFY_TICK  (1 << 16)
+
+static esp_timer_handle_t control_timer;
+
+/* closed loop state, only touched by the target task */
+static fanPidState_t pidState[NUM_TARGETS];
+static fanDuty_t feedForward[NUM_TARGETS];
+
+/* curve mode change limiting, only touched by the target task */
+static fanLimitState_t limitState[NUM_TARGETS];
+
+/* stall / degradation tracking, only touched by the target task */
+static fanHealthState_t healthState[NUM_TARGETS];
+/* channels whose fan has stopped, the others make up for the lost airflow */
+static uint8_t lostFans;
+
+/* copied from channelConfig when the curve is compiled */
+static fanChar_t fanChar[NUM_TARGETS];
+static fanDuty_t minDuty[NUM_TARGETS];        /* configured minimum, raised to what the fan needs if measured */
+
+/* set by another task that has taken over the channel's PWM, e.g. the characterisation sweep */
+static volatile bool held[NUM_TARGETS];
+
+/*
+ * Duty changes made while handling one wake-up are collected here and written
+ * to the LEDC once, after every notified channel, the failsafes and the
+ * control tick have had their turn. A channel touched twice in one pass only
+ * costs one register update.
+ */
 typedef enum {
-    TARGET_SET_TEMP,
-    TARGET_SET_DUTY,
-    TARGET_SET_LOAD,
-    TARGET_SET_RPM,
-} target_cmd_t;
+    TARGET_APPLY_NONE = 0,
+    TARGET_APPLY_FADE,
+    TARGET_APPLY_IMMEDIATE,
+} target_apply_t;
 
-struct setTempEvent {
-    uint8_t channel;
-    float temp;
-};
+static target_apply_t applyPending[NUM_TARGETS];
+static int64_t applyIngress[NUM_TARGETS];   /* oldest input behind the change, 0 if none */
+static int64_t applyCalc[NUM_TARGETS];      /* when the duty was decided */
 
-struct setDutyEvent {
-    uint8_t channel;
-    uint8_t duty;
-};
+static void target_report_health(uint8_t channel, uint32_t expected);
 
-struct setLoadEvent {
-    uint8_t channel;
-    float load;
-};
+static void target_queue_apply(uint8_t channel, fanDuty_t duty, target_apply_t how, int64_t ingress) {
+    targets[channel].duty = duty;
+    /* stopping a stalled fan on purpose clears it, which has to reach the other channels too */
+    if (fanhealth_duty(&healthState[channel], duty, esp_timer_get_time())) {
+        target_report_health(channel, 0);
+    }
+    /* an immediate write wins over a fade queued earlier in the same pass */
+    if (applyPending[channel] != TARGET_APPLY_IMMEDIATE) {
+        applyPending[channel] = how;
+    }
+    if (ingress && (applyIngress[channel] == 0 || ingress < applyIngress[channel])) {
+        applyIngress[channel] = ingress;
+    }
+    applyCalc[channel] = esp_timer_get_time();
+}
 
-struct setRPMEvent {
+/*
+ * Stale data failsafe. Every armed channel has a monotonic deadline; the
+ * deadlines live in a min-heap so the target task can sleep exactly until
+ * the earliest one and re-arming on a temperature update is a short sift.
+ */
+typedef struct {
+    int64_t deadline;
     uint8_t channel;
+} failsafe_entry_t;
+
+static failsafe_entry_t failsafeHeap[NUM_TARGETS];
+static int8_t failsafePos[NUM_TARGETS];
+static uint8_t failsafeCount;
+
+static void failsafe_swap(uint8_t a, uint8_t b) {
+    failsafe_entry_t tmp = failsafeHeap[a];
+    failsafeHeap[a] = failsafeHeap[b];
+    failsafeHeap[b] = tmp;
+    failsafePos[failsafeHeap[a].channel] = a;
+    failsafePos[failsafeHeap[b].channel] = b;
+}
+
+static void failsafe_sift(uint8_t i) {
+    while (i > 0 && failsafeHeap[(i - 1) / 2].deadline > failsafeHeap[i].deadline) {
+        failsafe_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        uint8_t l = 2 * i + 1, r = 2 * i + 2, m = i;
+        if (l < failsafeCount && failsafeHeap[l].deadline < failsafeHeap[m].deadline) m = l;
+        if (r < failsafeCount && failsafeHeap[r].deadline < failsafeHeap[m].deadline) m = r;
+        if (m == i) break;
+        failsafe_swap(i, m);
+        i = m;
+    }
+}
+
+static void failsafe_arm(uint8_t channel, int64_t deadline) {
+    int8_t i = failsafePos[channel];
+    if (i < 0) {
+        i = failsafeCount++;
+        failsafeHeap[i].channel = channel;
+        failsafePos[channel] = i;
+    }
+    failsafeHeap[i].deadline = deadline;
+    failsafe_sift(i);
+}
+
+static void failsafe_disarm(uint8_t channel) {
+    int8_t i = failsafePos[channel];
+    if (i < 0) {
+        return;
+    }
+    failsafePos[channel] = -1;
+    if (i != --failsafeCount) {
+        failsafeHeap[i] = failsafeHeap[failsafeCount];
+        failsafePos[failsafeHeap[i].channel] = i;
+        failsafe_sift(i);
+    }
+}
+
+/* (re)start the channel's timeout from now, or disarm it if it has none */
+static void failsafe_refresh(uint8_t channel, int64_t now) {
+    if (channelConfig[channel].enabled == false || channelConfig[channel].failsafeTimeout == 0) {
+        failsafe_disarm(channel);
+        return;
+    }
+    failsafe_arm(channel, now + (int64_t)channelConfig[channel].failsafeTimeout * 1000);
+}
+
+static void failsafe_expire(int64_t now) {
+    while (failsafeCount > 0 && failsafeHeap[0].deadline <= now) {
+        uint8_t channel = failsafeHeap[0].channel;
+        failsafe_disarm(channel);
+        ESP_LOGW(TAG, "Channel %d has timed out. Setting Full Duty", channel);
+        targets[channel].stale = true;
+        fanpid_reset(&pidState[channel]);
+        if (targets[channel].duty != FAN_DUTY_MAX) {
+            target_queue_apply(channel, FAN_DUTY_MAX, TARGET_APPLY_IMMEDIATE, 0);
+        }
+        esp_event_post(TARGET_EVENTS, TARGET_EVENT_STALE, &channel, sizeof(channel), 0);
+    }
+}
+
+/* how long the target task may sleep before the next deadline is due */
+static TickType_t failsafe_wait_ticks(int64_t now) {
+    if (failsafeCount == 0) {
+        return portMAX_DELAY;
+    }
+    int64_t remaining = failsafeHeap[0].deadline - now;
+    if (remaining <= 0) {
+        return 0;
+    }
+    return pdMS_TO_TICKS((remaining + 999) / 1000) + 1;
+}
+
+/*
+ * Latest-value mailbox per channel. Producers overwrite the field and set
+ * its dirty bit, then notify the target task with the channel's bit. A burst
+ * of updates collapses into the newest value instead of queueing.
+ */
+typedef struct {
+    uint8_t dirty;
+    float temp;
+    int64_t tempIngress;        /* esp_timer time the newest temp entered the device */
+    fanDuty_t duty;
+    int64_t dutyIngress;
+    float load;
     uint32_t rpm;
-};
+} target_mailbox_t;
+
+static target_mailbox_t mailbox[NUM_TARGETS];
+static portMUX_TYPE mailboxLock = portMUX_INITIALIZER_UNLOCKED;
 
-typedef struct TargetMessage_t {
-    target_cmd_t type;
-    union {
-        struct setTempEvent setTemp;
-        struct setDutyEvent setDuty;
-        struct setLoadEvent setLoad;
-        struct setRPMEvent setRPM;
-    } data;
-} TargetMessage_t;
+static target_stats_t targetStats;
 
+/*
+ * targets[] is owned by the target task. Readers get a copy from one of two
+ * published snapshots. The task writes the snapshot that is not current and
+ * then bumps targetGeneration; a reader retries only if the generation moved
+ * on while it was copying, so neither side ever waits on the other.
+ */
+static target_t targetSnapshot[2][NUM_TARGETS];
+static uint32_t targetGeneration;
 
+static void target_publish(void) {
+    uint32_t gen = __atomic_load_n(&targetGeneration, __ATOMIC_RELAXED) + 1;
+    /*
+     * A reader may still be copying this buffer from two generations back.
+     * The fence keeps the previous generation's store ahead of the copy, so
+     * a reader that sees any of the new bytes also sees the generation move.
+     */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(targetSnapshot[gen & 1], targets, sizeof(targets));
+    __atomic_store_n(&targetGeneration, gen, __ATOMIC_RELEASE);
+}
+
+static void target_compile_curve(uint8_t channel) {
+    if (xSemaphoreTake(configMutex, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to take config mutex");
+        return;
+    }
+    memcpy(&fanChar[channel], &channelConfig[channel].character, sizeof(fanChar_t));
+    minDuty[channel] = fanchar_min_duty(&fanChar[channel], FAN_DUTY_FROM_U8(channelConfig[channel].minDuty));
+    fancurve_compile(channel, channelConfig[channel].curve, channelConfig[channel].curvePoints,
+                     channelConfig[channel].lowTemp, channelConfig[channel].highTemp, minDuty[channel]);
+    uint32_t fadeRate = (uint32_t)channelConfig[channel].fadeRate * FAN_DUTY_FROM_U8(1);
+    uint16_t kickMs = channelConfig[channel].kickMs;
+    xSemaphoreGive(configMutex);
+    if (channel < board.channels) {
+        pwm_set_fade_rate(channel, fadeRate);
+        pwm_set_kick(channel, kickMs);
+    }
+    ESP_LOGD(TAG, "Compiled fan curve for channel %d (%d points)", channel, channelConfig[channel].curvePoints);
+}
+
+static void target_tick_cb(void *arg) {
+    xTaskNotify(xTargetTask, TARGET_NOTIFY_TICK, eSetBits);
+}
 
 esp_err_t StartTarget(void) {
     ESP_LOGD(TAG, "Starting target");
-    xTargetQueue = xQueueCreate(10, sizeof(TargetMessage_t));
-    if (xTargetQueue == NULL) {
-        ESP_LOGE(TAG, "Failed to create target queue");
-        return ESP_FAIL;
+    for (uint8_t i = 0; i < NUM_TARGETS; i++) {
+        target_compile_curve(i);
     }
-    for (int i = 0; i < NUM_TARGETS; i++) {
-        targetLock[i] = xSemaphoreCreateMutex();
-        if (targetLock[i] == NULL) {
-            ESP_LOGE(TAG, "Failed to create target lock");
-            return ESP_FAIL;
-        }
+    int64_t now = esp_timer_get_time();
+    for (uint8_t i = 0; i < NUM_TARGETS; i++) {
+        failsafePos[i] = -1;
+        fanhealth_reset(&healthState[i], targets[i].duty, now);
+    }
+    for (uint8_t i = 0; i < NUM_TARGETS; i++) {
+        failsafe_refresh(i, now);
+    }
+    target_publish();
+    if (xTaskCreate(vTaskTarget, "Target", 4096, NULL, 5, &xTargetTask) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create target task");
+        return ESP_FAIL;
     }
-    xTaskCreate(vTaskTarget, "Target", 4096, NULL, 5, NULL);
+    /* pick up anything posted before the task existed */
+    xTaskNotify(xTargetTask, (1 << NUM_TARGETS) - 1, eSetBits);
+
+    const esp_timer_create_args_t control_timer_args = {
+        .callback = &target_tick_cb,
+        .name = "control"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&control_timer_args, &control_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(control_timer, CONFIG_FANCTRL_CONTROL_PERIOD_MS * 1000));
     return ESP_OK;
 }
 
+/* called with mailboxLock held */
+static inline void target_mark_dirty(uint8_t channel, uint8_t field) {
+    if (mailbox[channel].dirty & field) {
+        targetStats.coalesced++;
+    }
+    mailbox[channel].dirty |= field;
+    targetStats.posted++;
+}
+
+static inline void target_notify(uint8_t channel) {
+    if (xTargetTask != NULL) {
+        xTaskNotify(xTargetTask, 1 << channel, eSetBits);
+    }
+}
+
 esp_err_t target_send_temp(uint8_t channel, float temp) {
+    return target_send_temp_stamped(channel, temp, esp_timer_get_time());
+}
+
+esp_err_t target_send_temp_stamped(uint8_t channel, float temp, int64_t ingress) {
     //ESP_LOGD(TAG, "Setting temp for channel %d to %d", channel, temp);
-    TargetMessage_t *msg;
-    msg = malloc(sizeof(TargetMessage_t));
-    if (msg == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for target message");
-        return ESP_FAIL;
-    }
-    msg->type = TARGET_SET_TEMP;
-    msg->data.setTemp.channel = channel;
-    msg->data.setTemp.temp = temp;
-    if (xQueueSend(xTargetQueue, &msg, 10) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to send message to target queue");
-        return ESP_FAIL;
+    /* a broken sensor must not re-arm the failsafe, let it time out to full duty instead */
+    if (channel >= board.channels || !isfinite(temp)) {
+        return ESP_ERR_INVALID_ARG;
     }
+    portENTER_CRITICAL(&mailboxLock);
+    mailbox[channel].temp = temp;
+    mailbox[channel].tempIngress = ingress;
+    target_mark_dirty(channel, TARGET_DIRTY_TEMP);
+    portEXIT_CRITICAL(&mailboxLock);
+    target_notify(channel);
     return ESP_OK;
 }
 
-esp_err_t target_send_duty(uint8_t channel, uint8_t duty) {
+esp_err_t target_send_duty(uint8_t channel, fanDuty_t duty) {
+    return target_send_duty_stamped(channel, duty, esp_timer_get_time());
+}
+
+esp_err_t target_send_duty_stamped(uint8_t channel, fanDuty_t duty, int64_t ingress) {
     //ESP_LOGD(TAG, "Setting duty for channel %d to %d", channel, duty);
-    TargetMessage_t *msg;
-    msg = malloc(sizeof(TargetMessage_t));
-    if (msg == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for message");
-        return ESP_FAIL;
-    }
-    msg->type = TARGET_SET_DUTY;
-    msg->data.setDuty.channel = channel;
-    msg->data.setDuty.duty = duty;
-    if (xQueueSend(xTargetQueue, &msg, 10) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to send message to target queue");
-        return ESP_FAIL;
+    if (channel >= board.channels) {
+        return ESP_ERR_INVALID_ARG;
     }
+    portENTER_CRITICAL(&mailboxLock);
+    mailbox[channel].duty = duty;
+    mailbox[channel].dutyIngress = ingress;
+    target_mark_dirty(channel, TARGET_DIRTY_DUTY);
+    portEXIT_CRITICAL(&mailboxLock);
+    target_notify(channel);
     return ESP_OK;
 }
 
 esp_err_t target_send_load(uint8_t channel, float load) {
     //ESP_LOGD(TAG, "Setting Load for channel %d to %f", channel, load);
-    TargetMessage_t *msg;
-    msg = malloc(sizeof(TargetMessage_t));
-    if (msg == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for message");
-        return ESP_FAIL;
-    }
-    msg->type = TARGET_SET_LOAD;
-    msg->data.setLoad.channel = channel;
-    msg->data.setLoad.load = load;
-    if (xQueueSend(xTargetQueue, &msg, 10) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to send message to target queue");
-        return ESP_FAIL;
+    if (channel >= board.channels) {
+        return ESP_ERR_INVALID_ARG;
     }
+    portENTER_CRITICAL(&mailboxLock);
+    mailbox[channel].load = load;
+    target_mark_dirty(channel, TARGET_DIRTY_LOAD);
+    portEXIT_CRITICAL(&mailboxLock);
+    target_notify(channel);
     return ESP_OK;
 }
 
 esp_err_t target_send_rpm(uint8_t channel, uint32_t rpm) {
     //ESP_LOGD(TAG, "Setting RPM for channel %d to %d", channel, rpm);
-    TargetMessage_t *msg;
-    msg = malloc(sizeof(TargetMessage_t));
-    if (msg == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for message");
-        return ESP_FAIL;
+    if (channel >= board.channels) {
+        return ESP_ERR_INVALID_ARG;
     }
-    msg->type = TARGET_SET_RPM;
-    msg->data.setRPM.channel = channel;
-    msg->data.setRPM.rpm = rpm;
-    if (xQueueSend(xTargetQueue, &msg, 10) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to send message to target queue");
-        return ESP_FAIL;
+    portENTER_CRITICAL(&mailboxLock);
+    mailbox[channel].rpm = rpm;
+    target_mark_dirty(channel, TARGET_DIRTY_RPM);
+    portEXIT_CRITICAL(&mailboxLock);
+    target_notify(channel);
+    return ESP_OK;
+}
+
+/* channelConfig changed - the target task recompiles the channel's fan curve */
+esp_err_t target_send_config(uint8_t channel) {
+    if (channel >= board.channels) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&mailboxLock);
+    target_mark_dirty(channel, TARGET_DIRTY_CONFIG);
+    portEXIT_CRITICAL(&mailboxLock);
+    target_notify(channel);
+    return ESP_OK;
+}
+
+esp_err_t target_hold(uint8_t channel, bool hold) {
+    if (channel >= NUM_TARGETS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    held[channel] = hold;
+    if (!hold) {
+        /* a pass writes out anything that changed while it was held */
+        target_notify(channel);
     }
     return ESP_OK;
 }
 
+esp_err_t target_get_stats(target_stats_t *stats) {
+    portENTER_CRITICAL(&mailboxLock);
+    memcpy(stats, &targetStats, sizeof(target_stats_t));
+    portEXIT_CRITICAL(&mailboxLock);
+    return ESP_OK;
+}
+
 esp_err_t target_get_data(uint8_t channel, target_t *data) {
-    if (channel > NUM_TARGETS) {
+    uint32_t gen;
+    if (channel >= board.channels) {
         ESP_LOGE(TAG, "Invalid channel");
-        return ESP_FAIL;
-    }
-    if (xSemaphoreTake(targetLock[channel], 100) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to take target lock");
-        ESP_LOGI(TAG, "Holder %s", pcTaskGetName(xSemaphoreGetMutexHolder(targetLock[channel])));
-        return ESP_FAIL;
+        return ESP_ERR_INVALID_ARG;
     }
-    memcpy(data, &targets[channel], sizeof(target_t));
-    xSemaphoreGive(targetLock[channel]);
+    do {
+        gen = __atomic_load_n(&targetGeneration, __ATOMIC_ACQUIRE);
+        memcpy(data, &targetSnapshot[gen & 1][channel], sizeof(target_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (gen != __atomic_load_n(&targetGeneration, __ATOMIC_RELAXED));
     return ESP_OK;
 }
 
+esp_err_t target_get_all(target_t data[NUM_TARGETS]) {
+    uint32_t gen;
+    do {
+        gen = __atomic_load_n(&targetGeneration, __ATOMIC_ACQUIRE);
+        memcpy(data, targetSnapshot[gen & 1], sizeof(targets));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (gen != __atomic_load_n(&targetGeneration, __ATOMIC_RELAXED));
+    return ESP_OK;
+}
+
+
+/* set by target_calc_duty for the latency histograms, 0 if the stage didn't happen */
+static int64_t stampCalc;
+/* ingress time of the temperature being handled, carried through to the apply */
+static int64_t calcIngress;
 
 esp_err_t target_calc_duty(int channel) {
+    stampCalc = 0;
     if (channel >= NUM_TARGETS) {
         ESP_LOGE(TAG, "Channel %d is out of range", channel);
         return ESP_ERR_INVALID_ARG;
@@ -182,156 +440,261 @@ esp_err_t target_calc_duty(int channel) {
         ESP_LOGI(TAG, "Channel %d is disabled", channel);
         return ESP_OK;
     }
-    time(&targets[channel].lastUpdate);
-    if (targets[channel].temp == 0 && targets[channel].duty != 255) {
-        ESP_LOGI(TAG, "Channel %d temp is 0. Setting Full Duty", channel);
-        targets[channel].duty = 255;
-        ESP_ERROR_CHECK(pwm_set_duty(channel, targets[channel].duty));
-        return ESP_OK;
-    }
-    if (targets[channel].temp < channelConfig[channel].lowTemp) {
-        ESP_LOGI(TAG, "Channel %d is below low temp", channel);
-        if (targets[channel].duty != 0) {
-            ESP_LOGI(TAG, "Setting channel %d to 0", channel);
-            targets[channel].duty = 0;
-            ESP_ERROR_CHECK(pwm_set_duty(channel, targets[channel].duty));
+    if (targets[channel].temp == 0) {
+        if (targets[channel].duty != FAN_DUTY_MAX) {
+            ESP_LOGI(TAG, "Channel %d temp is 0. Setting Full Duty", channel);
+            target_queue_apply(channel, FAN_DUTY_MAX, TARGET_APPLY_FADE, calcIngress);
         }
         return ESP_OK;
     }
-    if (targets[channel].temp > channelConfig[channel].highTemp) {
-        ESP_LOGI(TAG, "Channel %d is above high temp", channel);
-        if (targets[channel].duty != 255) {
-            ESP_LOGI(TAG, "Setting channel %d to 255", channel);
-            targets[channel].duty = 255;
-            ESP_ERROR_CHECK(pwm_set_duty(channel, targets[channel].duty));
+    fanDuty_t duty = fancurve_lookup(channel, targets[channel].temp);
+    uint32_t boost = __builtin_popcount(lostFans & ~(1 << channel)) * FAN_HEALTH_COMPENSATE;
+    if (boost) {
+        duty = duty + boost > FAN_DUTY_MAX ? FAN_DUTY_MAX : duty + boost;
+    }
+    stampCalc = esp_timer_get_time();
+    if (channelConfig[channel].mode == CHANNEL_MODE_PID) {
+        /* the curve picks the target speed, the control tick chases it */
+        targets[channel].targetRPM = (uint64_t)duty * channelConfig[channel].maxRPM / FAN_DUTY_MAX;
+        /* with a measured curve, start from the duty that should give that speed */
+        feedForward[channel] = fanChar[channel].valid ? fanchar_duty(&fanChar[channel], targets[channel].targetRPM) : duty;
+        if (duty > 0 && feedForward[channel] < minDuty[channel]) {
+            feedForward[channel] = minDuty[channel];
+        }
+        if (duty == 0) {
+            fanpid_reset(&pidState[channel]);
+            if (targets[channel].duty != 0) {
+                target_queue_apply(channel, 0, TARGET_APPLY_IMMEDIATE, calcIngress);
+            }
         }
         return ESP_OK;
     }
-    uint32_t tempRange = channelConfig[channel].highTemp - channelConfig[channel].lowTemp;
-    uint32_t tempOffset = targets[channel].temp - channelConfig[channel].lowTemp;
-    uint8_t duty = (uint8_t) (tempOffset * 255 / tempRange);
-    if (duty < channelConfig[channel].minDuty) {
-        ESP_LOGI(TAG, "Channel %d is below min duty - %d", channel, duty);
-        duty = channelConfig[channel].minDuty;
-    }
     if (duty == targets[channel].duty) {
         ESP_LOGD(TAG, "Channel %d duty is unchanged - %d", channel, duty);
+        limitState[channel].pending = false;
         return ESP_OK;
     }
-    targets[channel].duty = duty;
-    ESP_LOGD(TAG, "Calculated duty for channel %d to %d", channel, targets[channel].duty);
-    ESP_ERROR_CHECK(pwm_set_duty(channel, duty));
+    fanDuty_t limited = fanlimit_apply(&limitState[channel], &channelConfig[channel].limits, targets[channel].duty, duty,
+                                     targets[channel].temp, stampCalc);
+    if (limited == targets[channel].duty) {
+        ESP_LOGD(TAG, "Channel %d duty change to %d suppressed", channel, duty);
+        portENTER_CRITICAL(&mailboxLock);
+        targetStats.suppressed++;
+        portEXIT_CRITICAL(&mailboxLock);
+        return ESP_OK;
+    }
+    ESP_LOGD(TAG, "Calculated duty for channel %d to %d", channel, limited);
+    target_queue_apply(channel, limited, TARGET_APPLY_FADE, calcIngress);
     return ESP_OK;
 }
 
-void vTaskTarget(void* pvParameters) {
-    TargetMessage_t *msg;
-    ESP_LOGD(TAG, "Starting target task");
-    for (;;) {
-        if ( xQueueReceive( xTargetQueue, &(msg), ( TickType_t ) 1000 / portTICK_PERIOD_MS ) == pdPASS ) {
-            //ESP_LOGD(TAG, "Received message of type %d", msg->type);
-            switch (msg->type) {
-                case TARGET_SET_TEMP:
-                    if (msg->data.setTemp.channel >= NUM_TARGETS) {
-                        ESP_LOGE(TAG, "SetTemp: Channel %d is out of range", msg->data.setTemp.channel);
-                        break;
-                    }
-                    if (channelConfig[msg->data.setTemp.channel].enabled == false) {
-                        ESP_LOGE(TAG, "SetTemp: Channel %d is disabled", msg->data.setTemp.channel);
-                        break;
-                    }
-                    if (xSemaphoreTake(targetLock[msg->data.setTemp.channel], portMAX_DELAY) == pdFALSE) {
-                        ESP_LOGE(TAG, "SetTemp: Failed to take target lock");
-                        break;
-                    }
-                    ESP_LOGD(TAG, "Setting temp for channel %d to %f", msg->data.setTemp.channel, msg->data.setTemp.temp);
-                    targets[msg->data.setTemp.channel].temp = msg->data.setTemp.temp;
-                    targets[msg->data.setTemp.channel].lastUpdate = time(NULL);
-                    ESP_ERROR_CHECK(target_calc_duty(msg->data.setTemp.channel));
-                    xSemaphoreGive(targetLock[msg->data.setTemp.channel]);
-                    break;
-                case TARGET_SET_DUTY:
-                    if (msg->data.setDuty.channel >= NUM_TARGETS) {
-                        ESP_LOGE(TAG, "SetDuty: Channel %d is out of range", msg->data.setDuty.channel);
-                        break;
-                    }
-                    if (channelConfig[msg->data.setDuty.channel].enabled == false) {
-                        ESP_LOGE(TAG, "SetDuty: Channel %d is disabled", msg->data.setDuty.channel);
-                        break;
-                    }
-                    if (xSemaphoreTake(targetLock[msg->data.setDuty.channel], portMAX_DELAY) == pdFALSE) {
-                        ESP_LOGE(TAG, "SetDuty: Failed to take target lock");
-                        break;
-                    }
-                    ESP_LOGD(TAG, "Setting duty for channel %d to %d", msg->data.setDuty.channel, msg->data.setDuty.duty);
-                    targets[msg->data.setDuty.channel].duty = msg->data.setDuty.duty;
-                    ESP_ERROR_CHECK(pwm_set_duty(msg->data.setDuty.channel, targets[msg->data.setDuty.channel].duty));
-                    xSemaphoreGive(targetLock[msg->data.setDuty.channel]);
-                    break;
-                case TARGET_SET_LOAD:
-                    if (msg->data.setLoad.channel >= NUM_TARGETS) {
-                        ESP_LOGE(TAG, "SetLoad: Channel %d is out of range", msg->data.setLoad.channel);
-                        break;
-                    }
-                    if (channelConfig[msg->data.setLoad.channel].enabled == false) {
-                        ESP_LOGE(TAG, "SetLoad: Channel %d is disabled", msg->data.setLoad.channel);
-                        break;
-                    }
-                    if (xSemaphoreTake(targetLock[msg->data.setLoad.channel], portMAX_DELAY) == pdFALSE) {
-                        ESP_LOGE(TAG, "SetLoad: Failed to take target lock");
-                        break;
-                    }
-                    ESP_LOGD(TAG, "Setting Load for channel %d to %f", msg->data.setLoad.channel, msg->data.setLoad.load);
-                    targets[msg->data.setLoad.channel].load = msg->data.setLoad.load;
-                    xSemaphoreGive(targetLock[msg->data.setLoad.channel]);
-                    break;
-                case TARGET_SET_RPM:
-                    if (msg->data.setRPM.channel >= NUM_TARGETS) {
-                        ESP_LOGE(TAG, "setRPM: Channel %d is out of range", msg->data.setRPM.channel);
-                        break;
-                    }
-                    if (channelConfig[msg->data.setRPM.channel].enabled == false) {
-                        ESP_LOGE(TAG, "setRPM: Channel %d is disabled", msg->data.setRPM.channel);
-                        break;
-                    }
-                    if (xSemaphoreTake(targetLock[msg->data.setRPM.channel], portMAX_DELAY) == pdFALSE) {
-                        ESP_LOGE(TAG, "setRPM: Failed to take target lock");
-                        break;
-                    }
-                    ESP_LOGD(TAG, "Setting RPM for channel %d to %d", msg->data.setRPM.channel, msg->data.setRPM.rpm);
-                    targets[msg->data.setRPM.channel].rpm = msg->data.setRPM.rpm;
-                    xSemaphoreGive(targetLock[msg->data.setRPM.channel]);
-                    break;
+/* a fan stopped or came back - rework the duty of every other channel */
+static void target_set_lost(uint8_t channel, bool lost) {
+    uint8_t was = lostFans;
+    if (lost) {
+        lostFans |= 1 << channel;
+    } else {
+        lostFans &= ~(1 << channel);
+    }
+    if (lostFans == was) {
+        return;
+    }
+    for (uint8_t i = 0; i < board.channels; i++) {
+        if (i == channel || channelConfig[i].enabled == false || targets[i].stale) {
+            continue;
+        }
+        /* the temperature hasn't moved, so let the change past the deadband - it is still slew limited */
+        limitState[i].pending = true;
+        ESP_ERROR_CHECK(target_calc_duty(i));
+    }
+}
+
+/* run the new RPM reading past the stall / degradation detector */
+static void target_check_health(uint8_t channel, int64_t now) {
+    if (held[channel]) {
+        return;
+    }
+    uint32_t expected = fanChar[channel].valid ? fanchar_rpm(&fanChar[channel], targets[channel].duty)
+                                               : (uint64_t)targets[channel].duty * channelConfig[channel].maxRPM / FAN_DUTY_MAX;
+    bool changed = fanhealth_sample(&healthState[channel], targets[channel].rpm, expected, now);
+    /* below FAN_HEALTH_MIN_DUTY a stopped fan proves nothing, but one the output stage couldn't kick does */
+    if (pwm_kick_failed(channel)) {
+        changed |= fanhealth_kick_failed(&healthState[channel]);
+    }
+    if (changed) {
+        target_report_health(channel, expected);
+    }
+}
+
+/* the detector changed its mind - publish it, and rework the other channels if the fan stopped or came back */
+static void target_report_health(uint8_t channel, uint32_t expected) {
+    uint8_t status = healthState[channel].status;
+    targets[channel].health = status;
+    if (status == FAN_HEALTH_OK) {
+        ESP_LOGI(TAG, "Channel %d fan is healthy again", channel);
+    } else {
+        ESP_LOGW(TAG, "Channel %d fan is %s (duty %d, %d of %d RPM)", channel, fanhealth_name(status),
+                 targets[channel].duty, targets[channel].rpm, expected);
+    }
+    esp_event_post(TARGET_EVENTS, TARGET_EVENT_FAN_OK + status, &channel, sizeof(channel), 0);
+    target_set_lost(channel, status == FAN_HEALTH_STALLED || status == FAN_HEALTH_SPINUP_FAILED);
+}
+
+/* returns the number of updates taken from the mailbox */
+static uint8_t target_process_mailbox(uint8_t channel) {
+    target_mailbox_t msg;
+    portENTER_CRITICAL(&mailboxLock);
+    memcpy(&msg, &mailbox[channel], sizeof(target_mailbox_t));
+    mailbox[channel].dirty = 0;
+    portEXIT_CRITICAL(&mailboxLock);
+
+    if (msg.dirty == 0) {
+        return 0;
+    }
+    uint8_t drained = __builtin_popcount(msg.dirty);
+    int64_t popped = esp_timer_get_time();
+    if (msg.dirty & TARGET_DIRTY_CONFIG) {
+        target_compile_curve(channel);
+        fanpid_reset(&pidState[channel]);
+        if (!targets[channel].stale) {
+            failsafe_refresh(channel, esp_timer_get_time());
+        }
+    }
+    if (channelConfig[channel].enabled == false) {
+        ESP_LOGD(TAG, "Channel %d is disabled", channel);
+        /* a disabled channel's fan is expected to stop */
+        target_set_lost(channel, false);
+        return drained;
+    }
+    if (msg.dirty & TARGET_DIRTY_LOAD) {
+        ESP_LOGD(TAG, "Setting Load for channel %d to %f", channel, msg.load);
+        targets[channel].load = msg.load;
+    }
+    if (msg.dirty & TARGET_DIRTY_RPM) {
+        ESP_LOGD(TAG, "Setting RPM for channel %d to %d", channel, msg.rpm);
+        targets[channel].rpm = msg.rpm;
+        pwm_note_rpm(channel, msg.rpm);
+        target_check_health(channel, popped);
+    }
+    if (msg.dirty & TARGET_DIRTY_DUTY) {
+        ESP_LOGD(TAG, "Setting duty for channel %d to %d", channel, msg.duty);
+        latency_record(LATENCY_STAGE_QUEUE, popped - msg.dutyIngress);
+        target_queue_apply(channel, msg.duty, TARGET_APPLY_FADE, msg.dutyIngress);
+    }
+    if (msg.dirty & TARGET_DIRTY_TEMP) {
+        ESP_LOGD(TAG, "Setting temp for channel %d to %f", channel, msg.temp);
+        targets[channel].temp = msg.temp;
+        targets[channel].lastUpdate = time(NULL);
+        failsafe_refresh(channel, esp_timer_get_time());
+        if (targets[channel].stale) {
+            ESP_LOGI(TAG, "Channel %d has recovered", channel);
+            targets[channel].stale = false;
+            esp_event_post(TARGET_EVENTS, TARGET_EVENT_RECOVERED, &channel, sizeof(channel), 0);
+        }
+    }
+    if (targets[channel].stale == false && (msg.dirty & (TARGET_DIRTY_TEMP | TARGET_DIRTY_CONFIG))) {
+        int64_t calcStart = esp_timer_get_time();
+        calcIngress = (msg.dirty & TARGET_DIRTY_TEMP) ? msg.tempIngress : 0;
+        ESP_ERROR_CHECK(target_calc_duty(channel));
+        calcIngress = 0;
+        if (msg.dirty & TARGET_DIRTY_TEMP) {
+            latency_record(LATENCY_STAGE_QUEUE, popped - msg.tempIngress);
+            if (stampCalc) {
+                latency_record(LATENCY_STAGE_CALC, stampCalc - calcStart);
             }
-            free(msg);
+        }
+    }
+    return drained;
+}
+
+/* fixed rate pass for the channels running closed loop */
+static void target_control_tick(void) {
+    const float dt = CONFIG_FANCTRL_CONTROL_PERIOD_MS / 1000.0f;
+    for (uint8_t channel = 0; channel < board.channels; channel++) {
+        if (channelConfig[channel].enabled == false || targets[channel].stale) {
+            continue;
+        }
+        if (channelConfig[channel].mode != CHANNEL_MODE_PID) {
+            /* keep a slew limited curve mode change moving */
+            if (limitState[channel].pending) {
+                ESP_ERROR_CHECK(target_calc_duty(channel));
+            }
+            continue;
+        }
+        /* no temperature yet (held at full duty), or the curve says off */
+        if (targets[channel].temp == 0 || feedForward[channel] == 0) {
+            continue;
+        }
+        fanDuty_t duty = fanpid_step(&pidState[channel], &channelConfig[channel].pid, targets[channel].targetRPM,
+                                   targets[channel].rpm, channelConfig[channel].maxRPM, feedForward[channel],
+                                   dt, minDuty[channel]);
+        if (duty != targets[channel].duty) {
+            target_queue_apply(channel, duty, TARGET_APPLY_IMMEDIATE, 0);
+        }
+    }
+}
+
+/* write out everything queued during this wake-up, one LEDC update per channel */
+static uint8_t target_apply_pending(void) {
+    uint8_t applied = 0;
+    uint8_t written = 0;
+    /* everything decided in this wake-up reaches the outputs together */
+    pwm_group_begin();
+    for (uint8_t channel = 0; channel < board.channels; channel++) {
+        /* a held channel keeps its change until it is released */
+        if (applyPending[channel] == TARGET_APPLY_NONE || held[channel]) {
+            continue;
+        }
+        if (applyPending[channel] == TARGET_APPLY_IMMEDIATE) {
+            ESP_ERROR_CHECK(pwm_set_duty_immediate(channel, targets[channel].duty));
         } else {
+            ESP_ERROR_CHECK(pwm_set_duty(channel, targets[channel].duty));
+        }
+        written |= 1 << channel;
+    }
+    ESP_ERROR_CHECK(pwm_group_commit());
+
+    int64_t now = esp_timer_get_time();
+    for (uint8_t channel = 0; channel < board.channels; channel++) {
+        if (!(written & (1 << channel))) {
             continue;
-            ESP_LOGD(TAG, "Checking for Stale Data"); 
-            for (int i = 0; i < NUM_TARGETS; i++) {
-                if (channelConfig[i].enabled == false) {
-                    continue;
-                }
-                if (xSemaphoreTake(targetLock[i], portMAX_DELAY) == pdFALSE) {
-                    ESP_LOGE(TAG, "Stale Data: Failed to take target lock");
-                    continue;
-                }
-                if (targets[i].lastUpdate == 0) {
-                    ESP_LOGI(TAG, "Channel %d has not been updated", i);
-                    pwm_set_duty(i, 255);
-                    xSemaphoreGive(targetLock[i]);
-                    continue;
-                }
-                time_t now;
-                time(&now);
-                if (now - targets[i].lastUpdate > 5) {
-                    ESP_LOGI(TAG, "Channel %d has timed out", i);
-                    pwm_set_duty(i, 255);
-                    xSemaphoreGive(targetLock[i]);
-                    continue;
-                }
-                xSemaphoreGive(targetLock[i]);
+        }
+        latency_record(LATENCY_STAGE_APPLY, now - applyCalc[channel]);
+        if (applyIngress[channel]) {
+            latency_record(LATENCY_STAGE_TOTAL, now - applyIngress[channel]);
+        }
+        applyPending[channel] = TARGET_APPLY_NONE;
+        applyIngress[channel] = 0;
+        applied++;
+    }
+    return applied;
+}
+
+void vTaskTarget(void* pvParameters) {
+    uint32_t pending;
+    ESP_LOGD(TAG, "Starting target task");
+    for (;;) {
+        TickType_t wait = failsafe_wait_ticks(esp_timer_get_time());
+        if (xTaskNotifyWait(0, UINT32_MAX, &pending, wait) != pdPASS) {
+            pending = 0;
+        }
+        uint32_t drained = 0;
+        for (uint8_t channel = 0; channel < NUM_TARGETS; channel++) {
+            if (pending & (1 << channel)) {
+                drained += target_process_mailbox(channel);
             }
         }
+        failsafe_expire(esp_timer_get_time());
+        if (pending & TARGET_NOTIFY_TICK) {
+            target_control_tick();
+        }
+        uint8_t applied = target_apply_pending();
+        target_publish();
+        portENTER_CRITICAL(&mailboxLock);
+        targetStats.wakeups++;
+        targetStats.drained += drained;
+        targetStats.applied += applied;
+        portEXIT_CRITICAL(&mailboxLock);
     }
     ESP_LOGW(TAG, "Target task exiting");
 }
\ No newline at end of file
@@ -0,0 +1,376 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <esp_event.h>
+#include "hostrtos.h"
+
+/*
+ * Just enough of FreeRTOS, esp_timer and the event loop for the firmware's
+ * tasks to run on the host, see test/stubs/hostrtos.h. Shared by every test
+ * suite in the native env.
+ *
+ * Each task is a thread, but a thread only runs while it holds the turn:
+ * the test thread hands it to a ready task and gets it back when that task
+ * blocks. Nothing is ever preempted, which is what lets the critical
+ * sections and mutexes in the stubs be empty.
+ */
+
+#define HOST_TASKS      8
+#define HOST_TIMERS     8
+#define HOST_EVENTS     32
+#define HOST_FOREVER    INT64_MAX
+
+struct hostrtos_task {
+    pthread_t thread;
+    pthread_cond_t turn;
+    TaskFunction_t fn;
+    void *arg;
+    const char *name;
+    bool ready;
+    bool dead;
+    bool waiting;               /* blocked on a notification, a notify wakes it */
+    int64_t wakeAt;             /* simulated us the block times out */
+    uint32_t value;             /* notification value */
+    bool pending;
+    int64_t cpuNs;              /* thread CPU time spent holding the turn */
+};
+
+struct hostrtos_timer {
+    esp_timer_create_args_t args;
+    int64_t due;                /* -1 while stopped */
+    uint64_t period;            /* 0 for one shot */
+};
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    uint32_t count;
+} host_event_t;
+
+static pthread_mutex_t hostLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hostTurn = PTHREAD_COND_INITIALIZER;
+static struct hostrtos_task hostTask[HOST_TASKS];
+static uint8_t hostTasks;
+/* the task holding the turn, NULL while the test thread has it */
+static struct hostrtos_task *hostCurrent;
+static struct hostrtos_timer hostTimer[HOST_TIMERS];
+static uint8_t hostTimers;
+static int64_t hostNow = 1000000;
+static host_event_t hostEvent[HOST_EVENTS];
+
+static int64_t host_thread_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct hostrtos_task *host_self(const char *what) {
+    if (hostCurrent == NULL) {
+        printf("%s called from the test thread\n", what);
+        abort();
+    }
+    return hostCurrent;
+}
+
+/* called by a task giving up the turn, returns once it has it back */
+static void host_block(struct hostrtos_task *task) {
+    task->cpuNs += host_thread_ns();
+    pthread_mutex_lock(&hostLock);
+    hostCurrent = NULL;
+    pthread_cond_signal(&hostTurn);
+    while (hostCurrent != task) {
+        pthread_cond_wait(&task->turn, &hostLock);
+    }
+    pthread_mutex_unlock(&hostLock);
+    task->cpuNs -= host_thread_ns();
+}
+
+/* called by the test thread, returns once the task blocks */
+static void host_switch(struct hostrtos_task *task) {
+    pthread_mutex_lock(&hostLock);
+    task->ready = false;
+    hostCurrent = task;
+    pthread_cond_signal(&task->turn);
+    while (hostCurrent != NULL) {
+        pthread_cond_wait(&hostTurn, &hostLock);
+    }
+    pthread_mutex_unlock(&hostLock);
+}
+
+static void *host_task_main(void *arg) {
+    struct hostrtos_task *task = arg;
+    pthread_mutex_lock(&hostLock);
+    while (hostCurrent != task) {
+        pthread_cond_wait(&task->turn, &hostLock);
+    }
+    pthread_mutex_unlock(&hostLock);
+    task->cpuNs -= host_thread_ns();
+    task->fn(task->arg);
+    /* returning from a task function is a bug on the target, treat it as a delete here */
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t priority,
+                       TaskHandle_t *handle) {
+    if (hostTasks >= HOST_TASKS) {
+        return pdFAIL;
+    }
+    struct hostrtos_task *task = &hostTask[hostTasks++];
+    memset(task, 0, sizeof(*task));
+    pthread_cond_init(&task->turn, NULL);
+    task->fn = fn;
+    task->arg = arg;
+    task->name = name;
+    task->ready = true;
+    task->wakeAt = HOST_FOREVER;
+    if (pthread_create(&task->thread, NULL, host_task_main, task) != 0) {
+        hostTasks--;
+        return pdFAIL;
+    }
+    if (handle != NULL) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task != NULL && task != hostCurrent) {
+        task->dead = true;
+        return;
+    }
+    task = host_self("vTaskDelete(NULL)");
+    task->dead = true;
+    task->cpuNs += host_thread_ns();
+    pthread_mutex_lock(&hostLock);
+    hostCurrent = NULL;
+    pthread_cond_signal(&hostTurn);
+    pthread_mutex_unlock(&hostLock);
+    pthread_exit(NULL);
+}
+
+static int64_t host_deadline(TickType_t ticks) {
+    return ticks == portMAX_DELAY ? HOST_FOREVER : hostNow + (int64_t)ticks * 1000000 / CONFIG_FREERTOS_HZ;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    if (hostCurrent == NULL) {
+        hostrtos_run((int64_t)ticks * 1000000 / CONFIG_FREERTOS_HZ);
+        return;
+    }
+    struct hostrtos_task *task = hostCurrent;
+    task->wakeAt = host_deadline(ticks);
+    host_block(task);
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+    switch (action) {
+        case eSetBits:
+            task->value |= value;
+            break;
+        case eIncrement:
+            task->value++;
+            break;
+        case eSetValueWithOverwrite:
+            task->value = value;
+            break;
+        case eNoAction:
+            break;
+    }
+    task->pending = true;
+    if (task->waiting) {
+        task->ready = true;
+    }
+    return pdPASS;
+}
+
+/* block until notified or the ticks run out */
+static void host_wait(struct hostrtos_task *task, TickType_t ticks) {
+    if (ticks == 0) {
+        return;
+    }
+    task->waiting = true;
+    task->wakeAt = host_deadline(ticks);
+    host_block(task);
+    task->waiting = false;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t *value, TickType_t ticks) {
+    struct hostrtos_task *task = host_self("xTaskNotifyWait");
+    if (!task->pending) {
+        task->value &= ~clearOnEntry;
+        host_wait(task, ticks);
+    }
+    if (!task->pending) {
+        return pdFALSE;
+    }
+    if (value != NULL) {
+        *value = task->value;
+    }
+    task->value &= ~clearOnExit;
+    task->pending = false;
+    return pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+    struct hostrtos_task *task = host_self("ulTaskNotifyTake");
+    if (task->value == 0) {
+        host_wait(task, ticks);
+    }
+    uint32_t value = task->value;
+    if (value != 0) {
+        task->value = clearOnExit ? 0 : value - 1;
+    }
+    task->pending = false;
+    return value;
+}
+
+int64_t esp_timer_get_time(void) {
+    return hostNow;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle) {
+    if (hostTimers >= HOST_TIMERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    struct hostrtos_timer *timer = &hostTimer[hostTimers++];
+    timer->args = *args;
+    timer->due = -1;
+    *handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+    if (timer->due >= 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->period = period;
+    timer->due = hostNow + period;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout) {
+    if (timer->due >= 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->period = 0;
+    timer->due = hostNow + timeout;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (timer->due < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->due = -1;
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t base, int32_t id, const void *data, size_t size, TickType_t ticks) {
+    for (uint8_t i = 0; i < HOST_EVENTS; i++) {
+        host_event_t *event = &hostEvent[i];
+        if (event->base == NULL) {
+            event->base = base;
+            event->id = id;
+        }
+        if (event->base == base && event->id == id) {
+            event->count++;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+uint32_t hostrtos_events(esp_event_base_t base, int32_t id) {
+    for (uint8_t i = 0; i < HOST_EVENTS && hostEvent[i].base != NULL; i++) {
+        if (hostEvent[i].base == base && hostEvent[i].id == id) {
+            return hostEvent[i].count;
+        }
+    }
+    return 0;
+}
+
+void hostrtos_events_clear(void) {
+    memset(hostEvent, 0, sizeof(hostEvent));
+}
+
+int64_t hostrtos_cpu_ns(const char *name) {
+    for (uint8_t i = 0; i < hostTasks; i++) {
+        if (strcmp(hostTask[i].name, name) == 0) {
+            return hostTask[i].cpuNs;
+        }
+    }
+    return 0;
+}
+
+/* let every ready task run until it blocks, lowest created first */
+static void host_run_ready(void) {
+    for (;;) {
+        struct hostrtos_task *next = NULL;
+        for (uint8_t i = 0; i < hostTasks && next == NULL; i++) {
+            if (hostTask[i].ready && !hostTask[i].dead) {
+                next = &hostTask[i];
+            }
+        }
+        if (next == NULL) {
+            return;
+        }
+        host_switch(next);
+    }
+}
+
+void hostrtos_run(int64_t us) {
+    if (hostCurrent != NULL) {
+        printf("hostrtos_run called from task %s\n", hostCurrent->name);
+        abort();
+    }
+    int64_t end = hostNow + us;
+    host_run_ready();
+    for (;;) {
+        int64_t next = HOST_FOREVER;
+        for (uint8_t i = 0; i < hostTimers; i++) {
+            if (hostTimer[i].due >= 0 && hostTimer[i].due < next) {
+                next = hostTimer[i].due;
+            }
+        }
+        for (uint8_t i = 0; i < hostTasks; i++) {
+            if (!hostTask[i].ready && !hostTask[i].dead && hostTask[i].wakeAt < next) {
+                next = hostTask[i].wakeAt;
+            }
+        }
+        if (next > end) {
+            hostNow = end;
+            return;
+        }
+        if (next > hostNow) {
+            hostNow = next;
+        }
+        /* the esp_timer task's part: every callback that is due, before any task runs */
+        for (uint8_t i = 0; i < hostTimers; i++) {
+            struct hostrtos_timer *timer = &hostTimer[i];
+            if (timer->due >= 0 && timer->due <= hostNow) {
+                timer->due = timer->period ? timer->due + timer->period : -1;
+                timer->args.callback(timer->args.arg);
+            }
+        }
+        for (uint8_t i = 0; i < hostTasks; i++) {
+            if (!hostTask[i].ready && !hostTask[i].dead && hostTask[i].wakeAt <= hostNow) {
+                hostTask[i].wakeAt = HOST_FOREVER;
+                hostTask[i].ready = true;
+            }
+        }
+        host_run_ready();
+    }
+}
+
+/* src/timezone.cpp needs the timezone database, which isn't in the native env */
+esp_err_t setTZ(const char *tz) {
+    return ESP_OK;
+}
@@ -0,0 +1,18 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+#include "esp_err.h"
+
+/* the ESP32's pin map, the host has no pins to give back */
+typedef int gpio_num_t;
+
+#define GPIO_NUM_MAX 40
+#define GPIO_VALID_MASK (0xFFFFFFFFFFULL & ~(1ULL << 20 | 1ULL << 24 | 0xFULL << 28))
+#define GPIO_IS_VALID_GPIO(n) ((n) >= 0 && (n) < GPIO_NUM_MAX && ((GPIO_VALID_MASK >> (n)) & 1))
+#define GPIO_IS_VALID_OUTPUT_GPIO(n) (GPIO_IS_VALID_GPIO(n) && (n) < 34)
+
+static inline esp_err_t gpio_reset_pin(gpio_num_t pin) {
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+/*
+ * The FreeRTOS subset the firmware uses, run by the cooperative scheduler
+ * in test/hostrtos.c: one task at a time, switching only where a task
+ * blocks, so there is nothing for a critical section to keep out.
+ */
+#include <stdint.h>
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+#define pdMS_TO_TICKS(ms) ((TickType_t)((uint64_t)(ms) * CONFIG_FREERTOS_HZ / 1000))
+#define portTICK_PERIOD_MS (1000 / CONFIG_FREERTOS_HZ)
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+
+#define IRAM_ATTR
+
+#endif
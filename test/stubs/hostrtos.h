@@ -0,0 +1,23 @@
+#ifndef HOSTRTOS_H
+#define HOSTRTOS_H
+
+#include <stdint.h>
+#include <esp_event.h>
+
+/*
+ * Controls for the host scheduler in test/hostrtos.c. Tasks made with
+ * xTaskCreate get a thread each but only one thread runs at a time, handing
+ * over where a task blocks. Time is simulated: it starts at one second and
+ * only moves in hostrtos_run, which fires the esp_timers as their deadlines
+ * pass and runs every task they wake until it blocks again.
+ */
+
+/* run tasks and timers for us of simulated time, 0 just lets every ready task run */
+void hostrtos_run(int64_t us);
+/* esp_event_post calls for base and id since the last clear */
+uint32_t hostrtos_events(esp_event_base_t base, int32_t id);
+void hostrtos_events_clear(void);
+/* CPU time the named task has spent running, ns */
+int64_t hostrtos_cpu_ns(const char *name);
+
+#endif
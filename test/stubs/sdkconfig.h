@@ -0,0 +1,20 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+/* Kconfig defaults for the native test build, see src/Kconfig.projbuild */
+#define CONFIG_IDF_TARGET "native"
+#define CONFIG_FREERTOS_HZ 1000
+#define CONFIG_FANCTRL_BACKEND_SIM 1
+#define CONFIG_FANCTRL_CONTROL_PERIOD_MS 250
+#define CONFIG_FANCTRL_PWM_LEGACY 1
+#define CONFIG_FANCTRL_PWM_FREQ_HZ 5000
+#define CONFIG_FANCTRL_PWM_RESOLUTION_BITS 8
+#define CONFIG_FANCTRL_PWM_PHASE_STAGGER 1
+#define CONFIG_FANCTRL_TACHO_PARALLEL 1
+#define CONFIG_FANCTRL_TACHO_PRECISION 20
+#define CONFIG_FANCTRL_TACHO_PERIOD_EDGES 4
+#define CONFIG_FANCTRL_RPM_FILTER_MEDIAN 1
+#define CONFIG_FANCTRL_RPM_MEDIAN_N 5
+#define CONFIG_FANCTRL_RPM_EMA_SHIFT 2
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef SOC_CAPS_H
+#define SOC_CAPS_H
+
+/* as on the ESP32 */
+#define SOC_PCNT_UNITS_PER_GROUP 8
+
+#endif
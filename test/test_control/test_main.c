@@ -0,0 +1,172 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "fanconfig.h"
+#include "fancurve.h"
+#include "fanpid.h"
+#include "fanlimit.h"
+#include "backend.h"
+#include "pwm.h"
+#include "tacho.h"
+#include "target.h"
+#include "thermalsim.h"
+
+/*
+ * The control law on the host: curve tables, the PID step and the change
+ * limiter, then both control modes run through the target task against the
+ * thermal model for a simulated hour each.
+ */
+
+#define SIM_MINUTES 60
+
+static channelConfig_t config;
+
+static void default_config(channelConfig_t *c) {
+    memset(c, 0, sizeof(channelConfig_t));
+    c->enabled = true;
+    c->lowTemp = DEF_LOW_TEMP;
+    c->highTemp = DEF_HIGH_TEMP;
+    c->minDuty = DEF_LOW_DUTY;
+    c->mode = CHANNEL_MODE_CURVE;
+    c->maxRPM = DEF_MAX_RPM;
+    c->pid.kp = DEF_PID_KP;
+    c->pid.ki = DEF_PID_KI;
+    c->pid.kd = DEF_PID_KD;
+    c->limits.hysteresis = DEF_HYSTERESIS;
+    c->limits.minStep = DEF_MIN_STEP;
+    c->limits.slewRate = DEF_SLEW_RATE;
+}
+
+static void compile(uint8_t channel, const channelConfig_t *c) {
+    fancurve_compile(channel, c->curve, c->curvePoints, c->lowTemp, c->highTemp, FAN_DUTY_FROM_U8(c->minDuty));
+}
+
+void setUp(void) {
+    default_config(&config);
+    compile(0, &config);
+}
+
+void tearDown(void) {
+}
+
+static void test_curve_linear_ramp(void) {
+    TEST_ASSERT_EQUAL_UINT16(0, fancurve_lookup(0, DEF_LOW_TEMP - 1));
+    TEST_ASSERT_EQUAL_UINT16(FAN_DUTY_MAX, fancurve_lookup(0, DEF_HIGH_TEMP));
+    /* half way up the ramp is half duty, to within one 0.25 C step */
+    fanDuty_t mid = fancurve_lookup(0, (DEF_LOW_TEMP + DEF_HIGH_TEMP) / 2.0f);
+    TEST_ASSERT_UINT16_WITHIN(FAN_DUTY_MAX / (4 * (DEF_HIGH_TEMP - DEF_LOW_TEMP)), FAN_DUTY_MAX / 2, mid);
+    /* inside the curve the duty never drops below minDuty */
+    TEST_ASSERT_EQUAL_UINT16(FAN_DUTY_FROM_U8(DEF_LOW_DUTY), fancurve_lookup(0, DEF_LOW_TEMP + 0.25f));
+}
+
+static void test_curve_points_hold_last_duty(void) {
+    config.curvePoints = 3;
+    config.curve[0] = (fanCurvePoint_t){ 30, 50 };
+    config.curve[1] = (fanCurvePoint_t){ 50, 150 };
+    config.curve[2] = (fanCurvePoint_t){ 70, 200 };
+    compile(1, &config);
+    TEST_ASSERT_EQUAL_UINT16(0, fancurve_lookup(1, 29.75f));
+    TEST_ASSERT_EQUAL_UINT16(FAN_DUTY_FROM_U8(150), fancurve_lookup(1, 50));
+    TEST_ASSERT_EQUAL_UINT16(FAN_DUTY_FROM_U8(200), fancurve_lookup(1, 100));
+    /* past the end of the table the fan is always at full duty */
+    TEST_ASSERT_EQUAL_UINT16(FAN_DUTY_MAX, fancurve_lookup(1, FAN_CURVE_MAX_TEMP + 1));
+}
+
+static void test_curve_lookup_odd_temperatures(void) {
+    TEST_ASSERT_EQUAL_UINT16(FAN_DUTY_MAX, fancurve_lookup(0, NAN));
+    TEST_ASSERT_EQUAL_UINT16(fanCurveTable[0][0], fancurve_lookup(0, -40));
+    TEST_ASSERT_EQUAL_UINT16(FAN_DUTY_MAX, fancurve_lookup(0, INFINITY));
+    TEST_ASSERT_EQUAL_UINT16(FAN_DUTY_MAX, fancurve_lookup(0, 1e30f));
+}
+
+static void test_pid_clamps_and_stops_windup(void) {
+    fanPidState_t state;
+    fanpid_reset(&state);
+    fanDuty_t minDuty = FAN_DUTY_FROM_U8(DEF_LOW_DUTY);
+    /* fan far too slow for a long time: pinned at full duty */
+    for (int i = 0; i < 400; i++) {
+        TEST_ASSERT_EQUAL_UINT16(FAN_DUTY_MAX, fanpid_step(&state, &config.pid, DEF_MAX_RPM, 0, DEF_MAX_RPM,
+                                                           FAN_DUTY_MAX / 2, 0.25f, minDuty));
+    }
+    /* the integrator held while saturated, so an overspeed pulls the output straight back down */
+    fanDuty_t duty = fanpid_step(&state, &config.pid, DEF_MAX_RPM / 2, DEF_MAX_RPM, DEF_MAX_RPM, FAN_DUTY_MAX / 2, 0.25f, minDuty);
+    TEST_ASSERT_LESS_THAN_UINT16(FAN_DUTY_MAX / 2, duty);
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT16(minDuty, duty);
+}
+
+static void test_limit_deadband_and_endpoints(void) {
+    fanLimitState_t state = {};
+    fanDuty_t current = FAN_DUTY_MAX / 2;
+    /* a step smaller than minStep is held back */
+    TEST_ASSERT_EQUAL_UINT16(current, fanlimit_apply(&state, &config.limits, current, current + 1, 60, 1000));
+    /* so is one without enough temperature movement */
+    state.appliedTemp = 60;
+    TEST_ASSERT_EQUAL_UINT16(current, fanlimit_apply(&state, &config.limits, current, current + FAN_DUTY_MAX / 10, 60.5f, 2000));
+    /* full duty always gets through */
+    TEST_ASSERT_EQUAL_UINT16(FAN_DUTY_MAX, fanlimit_apply(&state, &config.limits, current, FAN_DUTY_MAX, 60.5f, 3000));
+}
+
+static void test_limit_slew(void) {
+    fanLimitState_t state = { .appliedTemp = 40, .appliedAt = 1000000 };
+    config.limits.slewRate = 51;            /* 0 -> 255 in 5 s */
+    fanDuty_t duty = fanlimit_apply(&state, &config.limits, 0, FAN_DUTY_MAX / 2, 60, 2000000);
+    TEST_ASSERT_EQUAL_UINT16(51 * FAN_DUTY_FROM_U8(1), duty);
+    TEST_ASSERT_TRUE(state.pending);
+}
+
+/* brought up the way main does, on the simulated backend, the first time a simulation needs it */
+static void start_tasks(void) {
+    static bool started;
+    if (started) {
+        return;
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, StartBackend());
+    TEST_ASSERT_EQUAL(ESP_OK, StartConfig());
+    TEST_ASSERT_EQUAL(ESP_OK, StartPWM());
+    TEST_ASSERT_EQUAL(ESP_OK, StartTacho());
+    TEST_ASSERT_EQUAL(ESP_OK, StartTarget());
+    started = true;
+}
+
+static void run_sim(const char *name) {
+    thermalsim_model_t model;
+    thermalsim_result_t result;
+    start_tasks();
+    thermalsim_default_model(&model);
+    TEST_ASSERT_EQUAL(ESP_OK, thermalsim_run(0, &config, SIM_MINUTES, &model, &result));
+    TEST_ASSERT_EQUAL_UINT32(SIM_MINUTES * 60 * 1000 / CONFIG_FANCTRL_CONTROL_PERIOD_MS, result.steps);
+    /* the loaded phase has to end up cooled, below the top of the curve */
+    TEST_ASSERT_TRUE(result.finalTemp > model.ambient);
+    TEST_ASSERT_TRUE(result.finalTemp < DEF_HIGH_TEMP);
+    TEST_ASSERT_TRUE(result.peakTemp >= result.finalTemp);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, result.controlNs);
+    printf("%s: %.0f s simulated in %.3f s wall (%.0fx), %u ns target task CPU per control step, settle %.1f s, "
+           "overshoot %.2f C, final %.1f C, %u duty changes\n",
+           name, result.simulatedSeconds, result.wallSeconds, result.speedup, (unsigned)result.controlNs, result.settleTime,
+           result.overshoot, result.finalTemp, (unsigned)result.dutyChanges);
+}
+
+static void test_sim_curve_hour(void) {
+    run_sim("curve");
+}
+
+static void test_sim_pid_hour(void) {
+    config.mode = CHANNEL_MODE_PID;
+    run_sim("pid");
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_curve_linear_ramp);
+    RUN_TEST(test_curve_points_hold_last_duty);
+    RUN_TEST(test_curve_lookup_odd_temperatures);
+    RUN_TEST(test_pid_clamps_and_stops_windup);
+    RUN_TEST(test_limit_deadband_and_endpoints);
+    RUN_TEST(test_limit_slew);
+    RUN_TEST(test_sim_curve_hour);
+    RUN_TEST(test_sim_pid_hour);
+    return UNITY_END();
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include "hostrtos.h"
+#include "backend_sim.h"
+#include "board.h"
+#include "fanconfig.h"
+#include "target.h"
+#include "thermalsim.h"
+
+static const char* TAG = "ThermalSim";
+
+#define SIM_SETTLE_BAND 1.0f
+/* the model moves on in steps of this, fine enough for the fade and the kick */
+#define SIM_STEP_US 50000
+#define SIM_PWM_FULL ((1u << CONFIG_FANCTRL_PWM_RESOLUTION_BITS) - 1)
+
+/* esp_timer_get_time is simulated time on the host, the wall clock comes from here */
+static int64_t sim_wall_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void thermalsim_default_model(thermalsim_model_t *model) {
+    model->ambient = 35;
+    model->heatCapacity = 200;
+    model->idlePower = 10;
+    model->loadPower = 60;
+    model->passiveCooling = 0.3;
+    model->fanCooling = 1.5;
+    model->fanTimeConstant = 1.5;
+    model->stallDuty = 20;
+}
+
+/* the fan follows whatever the PWM layer last wrote, and the tach counter sees it */
+static void sim_fan(uint8_t channel, const thermalsim_model_t *model, float *rpm, float dt) {
+    uint32_t counts, hpoint;
+    ESP_ERROR_CHECK(backend_sim_pwm(channel, &counts, &hpoint));
+    float wanted = counts * 255 < model->stallDuty * SIM_PWM_FULL ? 0 : (float)counts * channelConfig[channel].maxRPM / SIM_PWM_FULL;
+    *rpm += (wanted - *rpm) * (dt / (model->fanTimeConstant + dt));
+    backend_sim_set_pulses(board.ch[channel].tachPin, (uint32_t)*rpm * board.ch[channel].ppr);
+}
+
+esp_err_t thermalsim_run(uint8_t channel, const channelConfig_t *config, uint32_t minutes, const thermalsim_model_t *model,
+                         thermalsim_result_t *result) {
+    if (channel >= board.channels || minutes == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->maxRPM == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(configMutex, portMAX_DELAY);
+    memcpy(&channelConfig[channel], config, sizeof(channelConfig_t));
+    xSemaphoreGive(configMutex);
+    ESP_ERROR_CHECK(target_send_config(channel));
+
+    const float dt = SIM_STEP_US / 1000000.0f;
+    const uint32_t substeps = CONFIG_FANCTRL_CONTROL_PERIOD_MS * 1000 / SIM_STEP_US;
+    uint32_t steps = minutes * 60 * 1000 / CONFIG_FANCTRL_CONTROL_PERIOD_MS;
+    uint32_t loadStart = steps / 4, loadEnd = steps - steps / 4;
+    float *loaded = malloc((loadEnd - loadStart) * sizeof(float));
+    if (loaded == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    memset(result, 0, sizeof(thermalsim_result_t));
+    float temp = model->ambient;
+    float rpm[NUM_TARGETS] = {};
+    target_t data;
+    ESP_ERROR_CHECK(target_get_data(channel, &data));
+    fanDuty_t duty = data.duty;
+    int64_t wallStart = sim_wall_us();
+    int64_t cpuStart = hostrtos_cpu_ns("Target");
+
+    for (uint32_t i = 0; i < steps; i++) {
+        float load = (i >= loadStart && i < loadEnd) ? 1.0f : 0.1f;
+
+        /* one reading per control period, the rest of the board idles at ambient */
+        for (uint8_t ch = 0; ch < board.channels; ch++) {
+            ESP_ERROR_CHECK(target_send_temp(ch, ch == channel ? temp : model->ambient));
+        }
+        for (uint32_t s = 0; s < substeps; s++) {
+            for (uint8_t ch = 0; ch < board.channels; ch++) {
+                sim_fan(ch, model, &rpm[ch], dt);
+            }
+            float heat = model->idlePower + load * model->loadPower;
+            float cooling = (model->passiveCooling + model->fanCooling * rpm[channel] / config->maxRPM) * (temp - model->ambient);
+            temp += (heat - cooling) * dt / model->heatCapacity;
+            hostrtos_run(SIM_STEP_US);
+        }
+
+        ESP_ERROR_CHECK(target_get_data(channel, &data));
+        if (data.duty != duty) {
+            result->dutyChanges++;
+            result->dutyTravel += data.duty > duty ? data.duty - duty : duty - data.duty;
+            duty = data.duty;
+        }
+        if (i >= loadStart && i < loadEnd) {
+            loaded[i - loadStart] = temp;
+            if (temp > result->peakTemp) {
+                result->peakTemp = temp;
+            }
+        }
+    }
+
+    int64_t cpu = hostrtos_cpu_ns("Target") - cpuStart;
+    int64_t elapsed = sim_wall_us() - wallStart;
+    /* settled after the last loaded step outside the band around where the phase ended up */
+    result->finalTemp = loaded[loadEnd - loadStart - 1];
+    for (uint32_t i = loadEnd - loadStart; i > 0; i--) {
+        if (fabsf(loaded[i - 1] - result->finalTemp) > SIM_SETTLE_BAND) {
+            result->settleTime = i * CONFIG_FANCTRL_CONTROL_PERIOD_MS / 1000.0f;
+            break;
+        }
+    }
+    free(loaded);
+    result->steps = steps;
+    result->simulatedSeconds = steps * CONFIG_FANCTRL_CONTROL_PERIOD_MS / 1000.0f;
+    result->overshoot = result->peakTemp - result->finalTemp;
+    result->controlNs = cpu / steps;
+    result->wallSeconds = elapsed / 1000000.0f;
+    result->speedup = elapsed > 0 ? result->simulatedSeconds / result->wallSeconds : 0;
+    ESP_LOGI(TAG, "Channel %d: %d steps, settle %.1fs, overshoot %.2fC, %d duty changes, %d ns per step, %.3fs wall, %.0fx realtime",
+             channel, result->steps, result->settleTime, result->overshoot, result->dutyChanges, result->controlNs,
+             result->wallSeconds, result->speedup);
+    return ESP_OK;
+}
@@ -0,0 +1,50 @@
+#ifndef THERMALSIM_H
+#define THERMALSIM_H
+
+#include <stdint.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "fanconfig.h"
+
+/* lumped thermal model of one channel: a heat source cooled by its fan */
+typedef struct {
+    float ambient;              /* C */
+    float heatCapacity;         /* J/C */
+    float idlePower;            /* W at load 0 */
+    float loadPower;            /* additional W at load 1 */
+    float passiveCooling;       /* W/C with the fan stopped */
+    float fanCooling;           /* additional W/C at maxRPM */
+    float fanTimeConstant;      /* s for the rotor to follow a duty change */
+    uint8_t stallDuty;          /* below this duty (0-255) the fan does not turn */
+} thermalsim_model_t;
+
+typedef struct {
+    uint32_t steps;             /* control periods simulated */
+    float simulatedSeconds;
+    float settleTime;           /* s after the load step until temp stays within 1C of its final value */
+    float overshoot;            /* C above the final loaded temp */
+    float peakTemp;
+    float finalTemp;            /* temp at the end of the loaded phase */
+    uint32_t dutyChanges;
+    uint32_t dutyTravel;        /* sum of |duty change|, Q16 */
+    uint32_t controlNs;         /* target task CPU time per control period */
+    float wallSeconds;
+    float speedup;              /* simulated time / wall time */
+} thermalsim_result_t;
+
+void thermalsim_default_model(thermalsim_model_t *model);
+
+/*
+ * Run a channel under the config given against the model in simulated time:
+ * idle for the first quarter, full load for the middle half and idle again
+ * for the last quarter of the run. The temperature goes in through
+ * target_send_temp and the fan follows the simulated PWM output back into
+ * the tach counters, so it is the target task's control - fade, kick,
+ * failsafe, PID tick and all - that is measured. The target, PWM and tacho
+ * tasks must already be running on the simulated backend.
+ */
+esp_err_t thermalsim_run(uint8_t channel, const channelConfig_t *config, uint32_t minutes, const thermalsim_model_t *model,
+                         thermalsim_result_t *result);
+
+#endif
@@ -0,0 +1,227 @@
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unity.h>
+#include "rxring.h"
+
+/*
+ * The client receive ring and its framing, then a throughput comparison
+ * over a host socketpair: the old receive path, which peeked the header
+ * and read header and body separately with one frame per select wake-up,
+ * against one recv into the ring per wake-up with every buffered frame
+ * taken out of it.
+ */
+
+#define BENCH_FRAMES 200000
+#define BENCH_BODY 24           /* about the size of a status request */
+#define BENCH_CHUNK 4096
+
+static rxring_t ring;
+
+void setUp(void) {
+    rxring_reset(&ring);
+}
+
+void tearDown(void) {
+}
+
+static void put_frame(rxring_t *r, const uint8_t *body, uint32_t len) {
+    uint32_t header = htonl(len);
+    uint8_t frame[RX_RING_SIZE];
+    memcpy(frame, &header, RX_FRAME_HEADER);
+    memcpy(frame + RX_FRAME_HEADER, body, len);
+    for (uint32_t done = 0; done < RX_FRAME_HEADER + len;) {
+        size_t space;
+        uint8_t *at = rxring_write_ptr(r, &space);
+        size_t n = RX_FRAME_HEADER + len - done < space ? RX_FRAME_HEADER + len - done : space;
+        memcpy(at, frame + done, n);
+        rxring_produce(r, n);
+        done += n;
+    }
+}
+
+static void test_frame_states(void) {
+    uint8_t body[16] = "0123456789abcdef";
+    uint32_t len;
+    TEST_ASSERT_EQUAL(RX_FRAME_PARTIAL, rxring_frame(&ring, &len));
+    put_frame(&ring, body, sizeof(body));
+    /* hide the last byte of the body */
+    ring.head--;
+    TEST_ASSERT_EQUAL(RX_FRAME_PARTIAL, rxring_frame(&ring, &len));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(body), len);
+    ring.head++;
+    TEST_ASSERT_EQUAL(RX_FRAME_READY, rxring_frame(&ring, &len));
+    TEST_ASSERT_EQUAL_MEMORY(body, rxring_span(&ring, RX_FRAME_HEADER, len), len);
+    rxring_consume(&ring, RX_FRAME_HEADER + len);
+    TEST_ASSERT_EQUAL_UINT32(0, rxring_used(&ring));
+
+    /* a header announcing more than the ring can ever hold */
+    uint32_t header = htonl(RX_FRAME_MAX + 1);
+    size_t space;
+    memcpy(rxring_write_ptr(&ring, &space), &header, RX_FRAME_HEADER);
+    rxring_produce(&ring, RX_FRAME_HEADER);
+    TEST_ASSERT_EQUAL(RX_FRAME_INVALID, rxring_frame(&ring, &len));
+}
+
+static void test_frame_wraps_the_end(void) {
+    uint8_t body[200], out[200];
+    uint32_t len;
+    for (size_t i = 0; i < sizeof(body); i++) {
+        body[i] = i;
+    }
+    /* start 100 bytes short of the end, with a byte still queued so the ring can't rewind */
+    ring.tail = RX_RING_SIZE - 101;
+    ring.head = ring.tail + 1;
+    put_frame(&ring, body, sizeof(body));
+    rxring_consume(&ring, 1);
+    TEST_ASSERT_EQUAL(RX_FRAME_READY, rxring_frame(&ring, &len));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(body), len);
+    TEST_ASSERT_NULL(rxring_span(&ring, RX_FRAME_HEADER, len));
+    rxring_peek(&ring, RX_FRAME_HEADER, out, len);
+    TEST_ASSERT_EQUAL_MEMORY(body, out, len);
+}
+
+static void test_frame_largest(void) {
+    static uint8_t body[RX_FRAME_MAX];
+    uint32_t len;
+    memset(body, 0x5A, sizeof(body));
+    put_frame(&ring, body, sizeof(body));
+    TEST_ASSERT_EQUAL_UINT32(RX_RING_SIZE, rxring_used(&ring));
+    TEST_ASSERT_EQUAL(RX_FRAME_READY, rxring_frame(&ring, &len));
+    TEST_ASSERT_NOT_NULL(rxring_span(&ring, RX_FRAME_HEADER, len));
+}
+
+/* the socketpair benchmark */
+
+static void *bench_writer(void *arg) {
+    int fd = *(int *)arg;
+    uint8_t chunk[BENCH_CHUNK];
+    size_t fill = 0;
+    for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+        if (fill + RX_FRAME_HEADER + BENCH_BODY > sizeof(chunk)) {
+            if (write(fd, chunk, fill) != (ssize_t)fill) {
+                return NULL;
+            }
+            fill = 0;
+        }
+        uint32_t header = htonl(BENCH_BODY);
+        memcpy(chunk + fill, &header, RX_FRAME_HEADER);
+        memset(chunk + fill + RX_FRAME_HEADER, (uint8_t)i, BENCH_BODY);
+        fill += RX_FRAME_HEADER + BENCH_BODY;
+    }
+    if (fill > 0 && write(fd, chunk, fill) != (ssize_t)fill) {
+        return NULL;
+    }
+    return NULL;
+}
+
+typedef struct {
+    uint32_t frames;
+    uint32_t recvs;
+    uint32_t wakeups;
+    uint32_t bad;
+} bench_t;
+
+static void bench_wait(int fd, bench_t *bench) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    poll(&pfd, 1, -1);
+    bench->wakeups++;
+}
+
+static void bench_check(bench_t *bench, const uint8_t *body, uint32_t len) {
+    if (len != BENCH_BODY || body[0] != (uint8_t)bench->frames || body[len - 1] != (uint8_t)bench->frames) {
+        bench->bad++;
+    }
+    bench->frames++;
+}
+
+/* the old path: peek the header, read it, read the body, one frame per wake-up */
+static void bench_legacy(int fd, bench_t *bench) {
+    uint8_t body[RX_FRAME_MAX];
+    while (bench->frames < BENCH_FRAMES) {
+        uint32_t header;
+        bench_wait(fd, bench);
+        if (recv(fd, &header, sizeof(header), MSG_PEEK | MSG_WAITALL) != sizeof(header)) {
+            break;
+        }
+        recv(fd, &header, sizeof(header), MSG_WAITALL);
+        uint32_t len = ntohl(header);
+        if (len > sizeof(body) || recv(fd, body, len, MSG_WAITALL) != (ssize_t)len) {
+            break;
+        }
+        bench->recvs += 3;
+        bench_check(bench, body, len);
+    }
+}
+
+/* the ring path, as sock_recv does it */
+static void bench_ring(int fd, bench_t *bench) {
+    uint8_t body[RX_FRAME_MAX];
+    rxring_reset(&ring);
+    while (bench->frames < BENCH_FRAMES) {
+        size_t space;
+        bench_wait(fd, bench);
+        uint8_t *at = rxring_write_ptr(&ring, &space);
+        ssize_t got = recv(fd, at, space, 0);
+        if (got <= 0) {
+            break;
+        }
+        bench->recvs++;
+        rxring_produce(&ring, got);
+        uint32_t len;
+        while (rxring_frame(&ring, &len) == RX_FRAME_READY) {
+            const uint8_t *span = rxring_span(&ring, RX_FRAME_HEADER, len);
+            if (span == NULL) {
+                rxring_peek(&ring, RX_FRAME_HEADER, body, len);
+                span = body;
+            }
+            bench_check(bench, span, len);
+            rxring_consume(&ring, RX_FRAME_HEADER + len);
+        }
+    }
+}
+
+static double bench_run(const char *name, void (*reader)(int fd, bench_t *bench)) {
+    int fds[2];
+    pthread_t writer;
+    bench_t bench = {};
+    struct timespec start, end;
+
+    TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_EQUAL(0, pthread_create(&writer, NULL, bench_writer, &fds[1]));
+    reader(fds[0], &bench);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_join(writer, NULL);
+    close(fds[0]);
+    close(fds[1]);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%s: %u frames in %.3f s, %.0f frames/s, %.2f recv and %.2f wake-ups per frame\n", name,
+           (unsigned)bench.frames, seconds, bench.frames / seconds, (double)bench.recvs / bench.frames,
+           (double)bench.wakeups / bench.frames);
+    TEST_ASSERT_EQUAL_UINT32(BENCH_FRAMES, bench.frames);
+    TEST_ASSERT_EQUAL_UINT32(0, bench.bad);
+    return bench.frames / seconds;
+}
+
+static void test_bench_socketpair(void) {
+    double legacy = bench_run("peek, header, body", bench_legacy);
+    double ringed = bench_run("receive ring", bench_ring);
+    printf("receive ring: %.1fx the frames per second\n", ringed / legacy);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_frame_states);
+    RUN_TEST(test_frame_wraps_the_end);
+    RUN_TEST(test_frame_largest);
+    RUN_TEST(test_bench_socketpair);
+    return UNITY_END();
+}
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include <pb_encode.h>
+#include "rxring.h"
+#include "sockframe.h"
+
+/*
+ * Request frames pushed through the client receive ring in random sized
+ * pieces, the way recv hands them over, and decoded in place with
+ * sock_decode as sock_recv does. Both the contiguous and the wrapped
+ * decode have to give back exactly the request that was encoded.
+ */
+
+#define FUZZ_ROUNDS 200
+#define FUZZ_FRAMES 256           /* several ring lengths, so the larger pieces wrap */
+#define FUZZ_BODY_MAX 64
+#define FUZZ_STREAM_MAX (FUZZ_FRAMES * (RX_FRAME_HEADER + FUZZ_BODY_MAX))
+
+typedef struct {
+    uint32_t dispatched;
+    uint32_t contiguous;
+    uint32_t wrapped;
+    bool rejected;
+} fuzz_stats_t;
+
+static rxring_t ring;
+static uint8_t stream[FUZZ_STREAM_MAX];
+static espmsg_EspReq_Msg sent[FUZZ_FRAMES];
+
+void setUp(void) {
+    rxring_reset(&ring);
+    srand(0x5EED);
+}
+
+void tearDown(void) {
+}
+
+static void random_string(char *out, size_t size) {
+    size_t len = rand() % size;
+    for (size_t i = 0; i < len; i++) {
+        out[i] = 'a' + rand() % 26;
+    }
+    out[len] = '\0';
+}
+
+static void random_request(espmsg_EspReq_Msg *request) {
+    memset(request, 0, sizeof(espmsg_EspReq_Msg));
+    /* a real operation, an all default request encodes to nothing and is refused */
+    request->operation = 1 + rand() % espmsg_EspMsgType_OPGetLatency;
+    /* negative ids take the longest varints */
+    request->id = rand() % 2 ? rand() % 8 : rand() - RAND_MAX / 2;
+    switch (rand() % 4) {
+        case 1:
+            request->which_op = espmsg_EspReq_Msg_Login_tag;
+            random_string(request->op.Login.username, sizeof(request->op.Login.username));
+            random_string(request->op.Login.token, sizeof(request->op.Login.token));
+            break;
+        case 2:
+            request->which_op = espmsg_EspReq_Msg_Perf_tag;
+            request->op.Perf.temp = (rand() % 12000) / 100.0f;
+            request->op.Perf.load = (rand() % 1000) / 10.0f;
+            break;
+        case 3:
+            request->which_op = espmsg_EspReq_Msg_Duty_tag;
+            request->op.Duty.duty = (rand() % 25600) / 100.0f;
+            break;
+    }
+}
+
+static void check_request(const espmsg_EspReq_Msg *want, const espmsg_EspReq_Msg *got) {
+    TEST_ASSERT_EQUAL(want->operation, got->operation);
+    TEST_ASSERT_EQUAL(want->id, got->id);
+    TEST_ASSERT_EQUAL(want->which_op, got->which_op);
+    switch (want->which_op) {
+        case espmsg_EspReq_Msg_Login_tag:
+            TEST_ASSERT_EQUAL_STRING(want->op.Login.username, got->op.Login.username);
+            TEST_ASSERT_EQUAL_STRING(want->op.Login.token, got->op.Login.token);
+            break;
+        case espmsg_EspReq_Msg_Perf_tag:
+            TEST_ASSERT_EQUAL_MEMORY(&want->op.Perf, &got->op.Perf, sizeof(espmsg_ESPReq_SetPerf));
+            break;
+        case espmsg_EspReq_Msg_Duty_tag:
+            TEST_ASSERT_EQUAL_MEMORY(&want->op.Duty, &got->op.Duty, sizeof(espmsg_ESPReq_SetDuty));
+            break;
+    }
+}
+
+/* append one frame, with a body of len bytes or an encoded request if len is -1 */
+static size_t put_frame(size_t at, const espmsg_EspReq_Msg *request, int len) {
+    uint8_t *body = &stream[at + RX_FRAME_HEADER];
+    if (len < 0) {
+        pb_ostream_t output = pb_ostream_from_buffer(body, FUZZ_BODY_MAX);
+        TEST_ASSERT_TRUE(pb_encode(&output, espmsg_EspReq_Msg_fields, request));
+        len = output.bytes_written;
+    }
+    stream[at] = len >> 24;
+    stream[at + 1] = len >> 16;
+    stream[at + 2] = len >> 8;
+    stream[at + 3] = len;
+    return at + RX_FRAME_HEADER + len;
+}
+
+/* feed the stream in pieces of 1 - maxSegment bytes, taking out every whole frame after each */
+static void feed(size_t size, size_t maxSegment, fuzz_stats_t *stats) {
+    rxring_reset(&ring);
+    for (size_t done = 0; done < size;) {
+        size_t space;
+        uint8_t *at = rxring_write_ptr(&ring, &space);
+        TEST_ASSERT_TRUE(space > 0);
+        size_t piece = 1 + rand() % maxSegment;
+        piece = piece < size - done ? piece : size - done;
+        piece = piece < space ? piece : space;
+        memcpy(at, &stream[done], piece);
+        rxring_produce(&ring, piece);
+        done += piece;
+
+        uint32_t len;
+        rxframe_t frame;
+        while ((frame = rxring_frame(&ring, &len)) == RX_FRAME_READY) {
+            bool wraps = rxring_span(&ring, RX_FRAME_HEADER, len) == NULL;
+            espmsg_EspReq_Msg request = {};
+            if (!sock_decode(&ring, RX_FRAME_HEADER, len, &request)) {
+                /* sock_recv closes the connection here */
+                stats->rejected = true;
+                return;
+            }
+            TEST_ASSERT_TRUE(stats->dispatched < FUZZ_FRAMES);
+            check_request(&sent[stats->dispatched], &request);
+            stats->dispatched++;
+            if (wraps) {
+                stats->wrapped++;
+            } else {
+                stats->contiguous++;
+            }
+            rxring_consume(&ring, RX_FRAME_HEADER + len);
+        }
+        TEST_ASSERT_EQUAL(RX_FRAME_PARTIAL, frame);
+    }
+}
+
+static void test_fuzz_segments(void) {
+    static const size_t segments[] = { 1, 2, 3, 7, 16, 61, 256, RX_RING_SIZE };
+    uint32_t contiguous = 0, wrapped = 0;
+    for (int round = 0; round < FUZZ_ROUNDS; round++) {
+        size_t size = 0;
+        for (int i = 0; i < FUZZ_FRAMES; i++) {
+            random_request(&sent[i]);
+            size = put_frame(size, &sent[i], -1);
+        }
+        fuzz_stats_t stats = {};
+        feed(size, segments[round % (sizeof(segments) / sizeof(segments[0]))], &stats);
+        TEST_ASSERT_FALSE(stats.rejected);
+        TEST_ASSERT_EQUAL_UINT32(FUZZ_FRAMES, stats.dispatched);
+        TEST_ASSERT_EQUAL_UINT32(0, rxring_used(&ring));
+        contiguous += stats.contiguous;
+        wrapped += stats.wrapped;
+    }
+    char summary[80];
+    snprintf(summary, sizeof(summary), "%u contiguous and %u wrapped decodes", (unsigned)contiguous, (unsigned)wrapped);
+    TEST_MESSAGE(summary);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, contiguous);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, wrapped);
+}
+
+static void test_wrapped_frame(void) {
+    espmsg_EspReq_Msg request = {};
+    random_request(&sent[0]);
+    sent[0].which_op = espmsg_EspReq_Msg_Login_tag;
+    strcpy(sent[0].op.Login.username, "username");
+    strcpy(sent[0].op.Login.token, "password");
+    size_t size = put_frame(0, &sent[0], -1);
+    /* start so the body straddles the end of the ring, one byte still queued so it can't rewind */
+    ring.tail = RX_RING_SIZE - RX_FRAME_HEADER - size / 2 - 1;
+    ring.head = ring.tail + 1;
+    for (size_t done = 0; done < size;) {
+        size_t space;
+        uint8_t *at = rxring_write_ptr(&ring, &space);
+        size_t piece = size - done < space ? size - done : space;
+        memcpy(at, &stream[done], piece);
+        rxring_produce(&ring, piece);
+        done += piece;
+    }
+    rxring_consume(&ring, 1);
+    uint32_t len;
+    TEST_ASSERT_EQUAL(RX_FRAME_READY, rxring_frame(&ring, &len));
+    TEST_ASSERT_NULL(rxring_span(&ring, RX_FRAME_HEADER, len));
+    TEST_ASSERT_TRUE(sock_decode(&ring, RX_FRAME_HEADER, len, &request));
+    check_request(&sent[0], &request);
+}
+
+static void test_zero_length_frame(void) {
+    int empty = 1 + rand() % (FUZZ_FRAMES - 2);
+    size_t size = 0;
+    for (int i = 0; i < FUZZ_FRAMES; i++) {
+        random_request(&sent[i]);
+        size = put_frame(size, &sent[i], i == empty ? 0 : -1);
+    }
+    fuzz_stats_t stats = {};
+    feed(size, 16, &stats);
+    /* everything before it is handled, it and everything after is not */
+    TEST_ASSERT_TRUE(stats.rejected);
+    TEST_ASSERT_EQUAL_UINT32(empty, stats.dispatched);
+}
+
+static void test_garbage_body(void) {
+    espmsg_EspReq_Msg request = {};
+    size_t size = put_frame(0, NULL, 8);
+    memset(&stream[RX_FRAME_HEADER], 0xFF, 8);
+    size_t space;
+    memcpy(rxring_write_ptr(&ring, &space), stream, size);
+    rxring_produce(&ring, size);
+    uint32_t len;
+    TEST_ASSERT_EQUAL(RX_FRAME_READY, rxring_frame(&ring, &len));
+    TEST_ASSERT_FALSE(sock_decode(&ring, RX_FRAME_HEADER, len, &request));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_fuzz_segments);
+    RUN_TEST(test_wrapped_frame);
+    RUN_TEST(test_zero_length_frame);
+    RUN_TEST(test_garbage_body);
+    return UNITY_END();
+}
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "hostrtos.h"
+#include "backend.h"
+#include "backend_sim.h"
+#include "board.h"
+#include "fanconfig.h"
+#include "fanctrlevents.h"
+#include "fanhealth.h"
+#include "pwm.h"
+#include "tacho.h"
+#include "target.h"
+
+/*
+ * The target task, PWM fade engine and tacho task brought up the way main
+ * does, on the simulated backend, with every fan following its PWM output.
+ * Temperatures go in through target_send_temp, the duty comes back out of
+ * what the PWM layer wrote and the speed goes back in through the tach
+ * counters.
+ */
+
+#define PWM_FULL ((1u << CONFIG_FANCTRL_PWM_RESOLUTION_BITS) - 1)
+#define SIM_STEP_US 50000
+#define TEMP_COOL 40.0f
+#define TEMP_HOT 90.0f
+#define TEMP_HALF ((DEF_LOW_TEMP + DEF_HIGH_TEMP) / 2.0f)
+
+static float temps[NUM_TARGETS];
+static bool stalled[NUM_TARGETS];
+static bool silent;
+
+void setUp(void) {
+    static bool started;
+    if (!started) {
+        TEST_ASSERT_EQUAL(ESP_OK, StartBackend());
+        TEST_ASSERT_EQUAL(ESP_OK, StartConfig());
+        TEST_ASSERT_EQUAL(ESP_OK, StartPWM());
+        TEST_ASSERT_EQUAL(ESP_OK, StartTacho());
+        TEST_ASSERT_EQUAL(ESP_OK, StartTarget());
+        started = true;
+    }
+    for (uint8_t i = 0; i < NUM_TARGETS; i++) {
+        temps[i] = TEMP_COOL;
+        stalled[i] = false;
+    }
+    silent = false;
+    hostrtos_events_clear();
+}
+
+void tearDown(void) {
+}
+
+static uint32_t output(uint8_t channel) {
+    uint32_t counts, hpoint;
+    TEST_ASSERT_EQUAL(ESP_OK, backend_sim_pwm(channel, &counts, &hpoint));
+    return counts;
+}
+
+/* every fan turns at the speed its output asks for unless it is stalled, temps are sent once a second unless silent */
+static void run(uint32_t seconds) {
+    for (uint32_t step = 0; step < seconds * (1000000 / SIM_STEP_US); step++) {
+        if (!silent && step % (1000000 / SIM_STEP_US) == 0) {
+            for (uint8_t i = 0; i < board.channels; i++) {
+                TEST_ASSERT_EQUAL(ESP_OK, target_send_temp(i, temps[i]));
+            }
+        }
+        for (uint8_t i = 0; i < board.channels; i++) {
+            uint32_t rpm = stalled[i] ? 0 : output(i) * DEF_MAX_RPM / PWM_FULL;
+            backend_sim_set_pulses(board.ch[i].tachPin, rpm * board.ch[i].ppr);
+        }
+        hostrtos_run(SIM_STEP_US);
+    }
+}
+
+static void test_hot_channel_runs_full(void) {
+    temps[0] = TEMP_HOT;
+    run(10);
+    TEST_ASSERT_EQUAL_UINT32(PWM_FULL, output(0));
+    for (uint8_t i = 1; i < board.channels; i++) {
+        TEST_ASSERT_EQUAL_UINT32(0, output(i));
+    }
+    target_t data;
+    TEST_ASSERT_EQUAL(ESP_OK, target_get_data(0, &data));
+    TEST_ASSERT_EQUAL_UINT16(FAN_DUTY_MAX, data.duty);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, TEMP_HOT, data.temp);
+    /* the tach path got the speed back to the target task */
+    TEST_ASSERT_UINT32_WITHIN(DEF_MAX_RPM / 20, DEF_MAX_RPM, data.rpm);
+    TEST_ASSERT_EQUAL_UINT8(FAN_HEALTH_OK, data.health);
+}
+
+static void test_curve_fades_to_midpoint(void) {
+    temps[0] = TEMP_HALF;
+    run(10);
+    TEST_ASSERT_UINT32_WITHIN(PWM_FULL / 20, PWM_FULL / 2, output(0));
+    target_t data;
+    TEST_ASSERT_EQUAL(ESP_OK, target_get_data(0, &data));
+    TEST_ASSERT_UINT32_WITHIN(DEF_MAX_RPM / 20, DEF_MAX_RPM / 2, data.rpm);
+}
+
+static void test_stall_boosts_the_others(void) {
+    temps[0] = TEMP_HOT;
+    temps[1] = TEMP_HALF;
+    run(10);
+    uint32_t before = output(1);
+
+    stalled[0] = true;
+    run(5);
+    target_t data;
+    TEST_ASSERT_EQUAL(ESP_OK, target_get_data(0, &data));
+    TEST_ASSERT_EQUAL_UINT8(FAN_HEALTH_STALLED, data.health);
+    TEST_ASSERT_EQUAL_UINT32(1, hostrtos_events(TARGET_EVENTS, TARGET_EVENT_FAN_STALLED));
+    TEST_ASSERT_GREATER_THAN_UINT32(before + PWM_FULL / 8, output(1));
+
+    stalled[0] = false;
+    run(10);
+    TEST_ASSERT_EQUAL(ESP_OK, target_get_data(0, &data));
+    TEST_ASSERT_EQUAL_UINT8(FAN_HEALTH_OK, data.health);
+    TEST_ASSERT_EQUAL_UINT32(1, hostrtos_events(TARGET_EVENTS, TARGET_EVENT_FAN_OK));
+    TEST_ASSERT_UINT32_WITHIN(PWM_FULL / 20, before, output(1));
+}
+
+static void test_stopping_a_stalled_fan_clears_it(void) {
+    temps[0] = TEMP_HOT;
+    temps[1] = TEMP_HALF;
+    run(10);
+    uint32_t before = output(1);
+    stalled[0] = true;
+    run(5);
+    target_t data;
+    TEST_ASSERT_EQUAL(ESP_OK, target_get_data(0, &data));
+    TEST_ASSERT_EQUAL_UINT8(FAN_HEALTH_STALLED, data.health);
+
+    /* cooled down, the curve stops the fan - that ends the stall and the boost with it */
+    temps[0] = TEMP_COOL;
+    run(5);
+    TEST_ASSERT_EQUAL_UINT32(0, output(0));
+    TEST_ASSERT_EQUAL(ESP_OK, target_get_data(0, &data));
+    TEST_ASSERT_EQUAL_UINT8(FAN_HEALTH_OK, data.health);
+    TEST_ASSERT_EQUAL_UINT32(1, hostrtos_events(TARGET_EVENTS, TARGET_EVENT_FAN_OK));
+    TEST_ASSERT_UINT32_WITHIN(PWM_FULL / 20, before, output(1));
+
+    /* and the next start is judged afresh */
+    stalled[0] = false;
+    temps[0] = TEMP_HOT;
+    run(10);
+    TEST_ASSERT_EQUAL_UINT32(PWM_FULL, output(0));
+    TEST_ASSERT_EQUAL(ESP_OK, target_get_data(0, &data));
+    TEST_ASSERT_EQUAL_UINT8(FAN_HEALTH_OK, data.health);
+    TEST_ASSERT_EQUAL_UINT32(1, hostrtos_events(TARGET_EVENTS, TARGET_EVENT_FAN_STALLED));
+    TEST_ASSERT_UINT32_WITHIN(PWM_FULL / 20, before, output(1));
+}
+
+static void test_failsafe_on_silence(void) {
+    run(5);
+    TEST_ASSERT_EQUAL_UINT32(0, output(2));
+    /* nothing sent for longer than the failsafe timeout */
+    silent = true;
+    run(DEF_FAILSAFE_TIMEOUT / 1000 + 5);
+    target_t data;
+    TEST_ASSERT_EQUAL(ESP_OK, target_get_data(2, &data));
+    TEST_ASSERT_TRUE(data.stale);
+    TEST_ASSERT_EQUAL_UINT32(PWM_FULL, output(2));
+    TEST_ASSERT_GREATER_THAN_UINT32(0, hostrtos_events(TARGET_EVENTS, TARGET_EVENT_STALE));
+    silent = false;
+    run(5);
+    TEST_ASSERT_EQUAL(ESP_OK, target_get_data(2, &data));
+    TEST_ASSERT_FALSE(data.stale);
+    TEST_ASSERT_EQUAL_UINT32(0, output(2));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_hot_channel_runs_full);
+    RUN_TEST(test_curve_fades_to_midpoint);
+    RUN_TEST(test_stall_boosts_the_others);
+    RUN_TEST(test_stopping_a_stalled_fan_clears_it);
+    RUN_TEST(test_failsafe_on_silence);
+    return UNITY_END();
+}